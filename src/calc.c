@@ -23,14 +23,18 @@
 // SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 
 #include <errno.h>
+#include <fcntl.h>
 #include <gio/gio.h>
 #include <glib.h>
 #include <gmodule.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#include <gio/gunixsocketaddress.h>
 #include <rofi/helper.h>
 #include <rofi/mode-private.h>
 #include <rofi/mode.h>
@@ -38,8 +42,27 @@
 
 #include <stdint.h>
 
+#include "evaluator.h"
+#include "history.h"
+#include "protocol.h"
+#include "trace.h"
+
 G_MODULE_EXPORT Mode mode;
 
+// Where the accepted entry goes once the user picks it.
+typedef enum {
+    // Interpolate `calc-command` and run it through `/bin/sh -c`.
+    CALC_SINK_SHELL,
+    // Split `calc-command` into an argv and exec it directly.
+    CALC_SINK_EXEC,
+    // Write a JSON record to the FIFO at `calc-command`.
+    CALC_SINK_FIFO,
+    // Write a JSON record to the unix socket at `calc-command`.
+    CALC_SINK_SOCKET,
+    // Print a JSON record to stdout.
+    CALC_SINK_JSON,
+} CALCOutputSink;
+
 typedef struct {
     gboolean no_bold;
     gboolean no_unicode;
@@ -49,6 +72,12 @@ typedef struct {
     gboolean automatic_save_to_history;
     gboolean calc_command_uses_history;
     gboolean reuse_result;
+    gboolean no_daemon;
+    gboolean progressive;
+    CALCOutputSink output_sink;
+    guint timeout;
+    guint cpu_limit;
+    guint memory_limit;
 } CALCModeConfig;
 
 // The internal data structure holding the private data of the TEST Mode.
@@ -58,23 +87,53 @@ typedef struct {
     char *hint_welcome;
     char *calc_error_color;
     char *last_result;
+    // `last_result` parsed into a record, NULL unless it's a valid result.
+    HistoryRecord *last_record;
     char *previous_input;
+    char *daemon_socket;
+    // Generation of the most recently started evaluation and sequence (see
+    // `get_request_sequence`) of the one whose result is shown. Results
+    // never replace newer ones.
+    guint generation;
+    guint shown_sequence;
+    // Whether `last_result` is a quick result still being refined.
+    gboolean last_result_is_preliminary;
+    guint evaluations_in_flight;
+    // Input waiting for the debounce timer, see `schedule_evaluation`.
+    char *pending_input;
+    guint debounce_source;
+    // Input of the running full evaluation, waiting for the progressive
+    // delay, see `start_pending_evaluation`.
+    char *quick_input;
+    guint quick_source;
+    // Moving average of evaluation latency in microseconds.
+    gint64 average_latency;
+    guint evaluations_started;
+    guint evaluations_skipped;
+    guint evaluations_discarded;
+    // Targets of `calc-representations`, NULL if disabled.
+    gchar **representation_targets;
+    // The current input converted to each target, shown as rows between
+    // "Add to history" and the history.
+    GPtrArray *representations;
+    // Session trace, NULL unless `calc-trace` is set.
+    Trace *trace;
     GPtrArray *history;
     CALCModeConfig config;
+    // Set when the mode was destroyed while evaluations were in flight. The
+    // last of them to finish frees this.
+    gboolean destroyed;
 } CALCModePrivateData;
 
-// Used in splitting equations into {expression} and {result}.
-#define PARENS_LEFT '('
-#define PARENS_RIGHT ')'
-#define EQUALS_SIGN '='
-#define APPROX_SIGN "≈"
-
 // qalc binary name
 #define QALC_BINARY_OPTION "-qalc-binary"
 
 // Calc command option
 #define CALC_COMMAND_OPTION "calc-command"
 
+// How calc command is run: shell, exec, fifo, socket or json
+#define CALC_COMMAND_MODE_OPTION "calc-command-mode"
+
 // Whether calc command emits a history entry
 #define CALC_COMMAND_USES_HISTORY "calc-command-history"
 
@@ -112,154 +171,91 @@ typedef struct {
 #define NO_PERSIST_HISTORY_OPTION "no-persist-history"
 #define NO_HISTORY_OPTION "no-history"
 #define AUTOMATIC_SAVE_TO_HISTORY "automatic-save-to-history"
-#define HISTORY_LENGTH 100
-
-// Limit `str` to at most `limit` new lines.
-// Returns a new string of either the limited length or the length length.
-// However, in both cases, it's a new string.
-static gchar *limit_to_n_newlines(gchar *str, uint32_t limit) {
-    uint32_t newlines = 0;
-    uint32_t last_index = 0;
-    uint32_t string_length = strlen(str);
 
-    while (last_index < string_length) {
-        if (str[last_index] == '\n') {
-            newlines++;
+// Evaluation limits
+#define TIMEOUT_OPTION "calc-timeout"
+#define CPU_LIMIT_OPTION "calc-cpu-limit"
+#define MEMORY_LIMIT_OPTION "calc-memory-limit"
+
+// Debouncing. Inputs are only held back while an evaluation is running,
+// for half the average evaluation latency, but at most `DEBOUNCE_MAX` ms.
+// Evaluations faster than `DEBOUNCE_MIN_LATENCY` ms are never debounced.
+#define DEBOUNCE_MIN_LATENCY 20
+#define DEBOUNCE_MAX 250
+// Weight of the newest sample in the latency average, as 1/n.
+#define LATENCY_AVERAGE_WEIGHT 4
+
+// Progressive results. A quick evaluation starts once the full one has been
+// running for `PROGRESSIVE_DELAY` ms.
+#define PROGRESSIVE_OPTION "progressive"
+#define PROGRESSIVE_DELAY 100
+
+// Comma separated qalc conversion targets shown as extra rows, e.g.
+// "hex,bin,sci"
+#define REPRESENTATIONS_OPTION "calc-representations"
+
+// Record inputs, actions and evaluations to a trace file for
+// `rofi-calc-replay`
+#define TRACE_OPTION "calc-trace"
+
+// Daemon stuff
+#define NO_DAEMON_OPTION "no-daemon"
+#define DAEMON_SOCKET_OPTION "calc-daemon-socket"
+// Seconds to wait on an unresponsive daemon before doing the work in-process.
+// Evaluations additionally get their own timeout.
+#define DAEMON_TIMEOUT 1
+
+// Map a `calc-command-mode` value to its sink, falling back to the shell.
+static CALCOutputSink parse_output_sink(const char *name) {
+    static const struct {
+        const char *name;
+        CALCOutputSink sink;
+    } sinks[] = {
+        {"shell", CALC_SINK_SHELL},   {"exec", CALC_SINK_EXEC},
+        {"fifo", CALC_SINK_FIFO},     {"socket", CALC_SINK_SOCKET},
+        {"json", CALC_SINK_JSON},
+    };
+
+    for (gsize i = 0; i < G_N_ELEMENTS(sinks); i++) {
+        if (g_ascii_strcasecmp(name, sinks[i].name) == 0) {
+            return sinks[i].sink;
         }
-
-        if (newlines >= limit) {
-            gchar *limited_str = g_strndup(str, last_index);
-            return limited_str;
-        }
-
-        last_index++;
     }
 
-    return g_strdup(str);
+    g_warning("Unknown %s '%s', using 'shell'", CALC_COMMAND_MODE_OPTION,
+              name);
+    return CALC_SINK_SHELL;
 }
 
-// Append `input` to history.
-static void append_str_to_history(gchar *input) {
-    GError *error = NULL;
-    gchar *history_dir = g_build_filename(g_get_user_data_dir(), "rofi", NULL);
-    gchar *history_file =
-        g_build_filename(history_dir, "rofi_calc_history", NULL);
-    gchar *history_contents;
-    gboolean old_history_was_read = FALSE;
-
-    g_mkdir_with_parents(history_dir, 0755);
-
-    if (g_file_test(history_file,
-                    G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR)) {
-        g_file_get_contents(history_file, &history_contents, NULL, &error);
-        old_history_was_read = TRUE;
-
-        if (error != NULL) {
-            g_error("Error while reading the history file: %s", error->message);
-            g_error_free(error);
+// Parse the comma separated `calc-representations` option.
+static void set_representation_targets(CALCModePrivateData *pd,
+                                       const char *representations) {
+    g_strfreev(pd->representation_targets);
+    pd->representation_targets = NULL;
+
+    GPtrArray *targets = g_ptr_array_new();
+    gchar **names = g_strsplit(representations, ",", -1);
+    for (gchar **name = names; *name != NULL; name++) {
+        g_strstrip(*name);
+        if (**name != '\0') {
+            g_ptr_array_add(targets, g_strdup(*name));
         }
-    } else {
-        // Empty history, initialize it.
-        history_contents = "";
-    }
-
-    gchar *new_history = g_strjoin("\n", history_contents, input, NULL);
-    g_strstrip(new_history);
-
-    gchar *limited_str = g_strreverse(
-        limit_to_n_newlines(g_strreverse(new_history), HISTORY_LENGTH));
-
-    g_file_set_contents(history_file, limited_str, -1, &error);
-
-    if (error != NULL) {
-        g_error("Error while writing the history file: %s", error->message);
-        g_error_free(error);
     }
+    g_strfreev(names);
 
-    g_free(limited_str);
-    g_free(new_history);
-    if (old_history_was_read) {
-        g_free(history_contents);
-    }
-    g_free(history_file);
-    g_free(history_dir);
-}
-
-// Count number of new lines in a string.
-static uint32_t get_number_of_newlines(gchar *string, gsize length) {
-    uint32_t lines = 0;
-    for (uint32_t i = 0; i < length; i++) {
-        if (string[i] == '\n') {
-            lines++;
-        }
-    }
-
-    return lines;
-}
-
-// Delete a certain line number from history.
-static void delete_line_from_history(uint32_t line) {
-    GError *error = NULL;
-    gchar *history_dir = g_build_filename(g_get_user_data_dir(), "rofi", NULL);
-    gchar *history_file =
-        g_build_filename(history_dir, "rofi_calc_history", NULL);
-    gchar *history_contents;
-    gsize history_length;
-    gboolean old_history_was_read = FALSE;
-
-    if (g_file_test(history_file,
-                    G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR)) {
-        g_file_get_contents(history_file, &history_contents, &history_length,
-                            &error);
-        old_history_was_read = TRUE;
-
-        if (error != NULL) {
-            g_error("Error while reading the history file: %s", error->message);
-            g_error_free(error);
-        }
+    if (targets->len > 0) {
+        g_ptr_array_add(targets, NULL);
+        pd->representation_targets =
+            (gchar **)g_ptr_array_free(targets, FALSE);
     } else {
-        // Empty history, do nothing and exit early.
-        return;
+        g_ptr_array_free(targets, TRUE);
     }
-
-    uint32_t newlines =
-        get_number_of_newlines(history_contents, history_length);
-    GString *new_history = g_string_new("");
-    uint32_t current_line = 0;
-    uint32_t line_to_delete = newlines - line;
-    for (gsize c = 0; c < history_length; c++) {
-        if (history_contents[c] == '\n') {
-            current_line++;
-        }
-
-        // Skip any copying of history if the line we're on is the line we're
-        // trying to get rid of.
-        if (current_line == line_to_delete) {
-            continue;
-        }
-
-        new_history = g_string_append_c(new_history, history_contents[c]);
-    }
-
-    gchar *new_history_str = g_string_free(new_history, FALSE);
-    g_file_set_contents(history_file, new_history_str, -1, &error);
-
-    if (error != NULL) {
-        g_error("Error while writing the history file: %s", error->message);
-        g_error_free(error);
-    }
-
-    g_free(new_history_str);
-    if (old_history_was_read) {
-        g_free(history_contents);
-    }
-    g_free(history_file);
-    g_free(history_dir);
 }
 
 // sets config values from rofi config file and command line
 // command line options have higher priority than config file
 static void set_config(Mode *sw) {
+    const char *trace_file = NULL;
     CALCModePrivateData *pd = (CALCModePrivateData *)mode_get_private_data(sw);
     ConfigEntry *config_file = rofi_config_find_widget(sw->name, NULL, TRUE);
 
@@ -271,10 +267,16 @@ static void set_config(Mode *sw) {
     pd->config.automatic_save_to_history = FALSE;
     pd->config.calc_command_uses_history = FALSE;
     pd->config.reuse_result = FALSE;
+    pd->config.no_daemon = FALSE;
+    pd->config.progressive = FALSE;
+    pd->config.output_sink = CALC_SINK_SHELL;
+    pd->config.timeout = EVALUATOR_DEFAULT_TIMEOUT;
+    pd->config.cpu_limit = 0;
+    pd->config.memory_limit = 0;
 
-    pd->hint_result = HINT_RESULT_STR;
-    pd->hint_welcome = HINT_WELCOME_STR;
-    pd->calc_error_color = CALC_ERROR_COLOR_STR;
+    pd->hint_result = g_strdup(HINT_RESULT_STR);
+    pd->hint_welcome = g_strdup(HINT_WELCOME_STR);
+    pd->calc_error_color = g_strdup(CALC_ERROR_COLOR_STR);
 
     if (config_file != NULL) {
         Property *no_bold = rofi_theme_find_property(config_file, P_BOOLEAN,
@@ -299,14 +301,24 @@ static void set_config(Mode *sw) {
             config_file, P_STRING, CALC_COMMAND_OPTION, TRUE);
         if (cmd_option != NULL &&
             (cmd_option->type == P_STRING && cmd_option->value.s)) {
+            g_free(pd->cmd);
             pd->cmd = g_strdup(cmd_option->value.s);
         }
 
+        Property *cmd_mode_option = rofi_theme_find_property(
+            config_file, P_STRING, CALC_COMMAND_MODE_OPTION, TRUE);
+        if (cmd_mode_option != NULL &&
+            (cmd_mode_option->type == P_STRING && cmd_mode_option->value.s)) {
+            pd->config.output_sink =
+                parse_output_sink(cmd_mode_option->value.s);
+        }
+
         Property *hint_result_option = rofi_theme_find_property(
             config_file, P_STRING, HINT_RESULT_OPTION, TRUE);
         if (hint_result_option != NULL &&
             (hint_result_option->type == P_STRING &&
              hint_result_option->value.s)) {
+            g_free(pd->hint_result);
             pd->hint_result = g_strdup(hint_result_option->value.s);
         }
 
@@ -315,6 +327,7 @@ static void set_config(Mode *sw) {
         if (hint_welcome_option != NULL &&
             (hint_welcome_option->type == P_STRING &&
              hint_welcome_option->value.s)) {
+            g_free(pd->hint_welcome);
             pd->hint_welcome = g_strdup(hint_welcome_option->value.s);
         }
 
@@ -323,6 +336,7 @@ static void set_config(Mode *sw) {
         if (calc_error_color_option != NULL &&
             (calc_error_color_option->type == P_STRING &&
              calc_error_color_option->value.s)) {
+            g_free(pd->calc_error_color);
             pd->calc_error_color = g_strdup(calc_error_color_option->value.s);
         }
 
@@ -360,6 +374,61 @@ static void set_config(Mode *sw) {
         if (reuse_result != NULL && (reuse_result->type == P_BOOLEAN)) {
             pd->config.reuse_result = reuse_result->value.b;
         }
+
+        Property *timeout = rofi_theme_find_property(config_file, P_INTEGER,
+                                                     TIMEOUT_OPTION, TRUE);
+        if (timeout != NULL && (timeout->type == P_INTEGER) &&
+            timeout->value.i >= 0) {
+            pd->config.timeout = timeout->value.i;
+        }
+
+        Property *cpu_limit = rofi_theme_find_property(
+            config_file, P_INTEGER, CPU_LIMIT_OPTION, TRUE);
+        if (cpu_limit != NULL && (cpu_limit->type == P_INTEGER) &&
+            cpu_limit->value.i >= 0) {
+            pd->config.cpu_limit = cpu_limit->value.i;
+        }
+
+        Property *memory_limit = rofi_theme_find_property(
+            config_file, P_INTEGER, MEMORY_LIMIT_OPTION, TRUE);
+        if (memory_limit != NULL && (memory_limit->type == P_INTEGER) &&
+            memory_limit->value.i >= 0) {
+            pd->config.memory_limit = memory_limit->value.i;
+        }
+
+        Property *progressive = rofi_theme_find_property(
+            config_file, P_BOOLEAN, PROGRESSIVE_OPTION, TRUE);
+        if (progressive != NULL && (progressive->type == P_BOOLEAN)) {
+            pd->config.progressive = progressive->value.b;
+        }
+
+        Property *no_daemon = rofi_theme_find_property(
+            config_file, P_BOOLEAN, NO_DAEMON_OPTION, TRUE);
+        if (no_daemon != NULL && (no_daemon->type == P_BOOLEAN)) {
+            pd->config.no_daemon = no_daemon->value.b;
+        }
+
+        Property *daemon_socket_option = rofi_theme_find_property(
+            config_file, P_STRING, DAEMON_SOCKET_OPTION, TRUE);
+        if (daemon_socket_option != NULL &&
+            (daemon_socket_option->type == P_STRING &&
+             daemon_socket_option->value.s)) {
+            pd->daemon_socket = g_strdup(daemon_socket_option->value.s);
+        }
+
+        Property *representations = rofi_theme_find_property(
+            config_file, P_STRING, REPRESENTATIONS_OPTION, TRUE);
+        if (representations != NULL &&
+            (representations->type == P_STRING && representations->value.s)) {
+            set_representation_targets(pd, representations->value.s);
+        }
+
+        Property *trace_option = rofi_theme_find_property(
+            config_file, P_STRING, TRACE_OPTION, TRUE);
+        if (trace_option != NULL &&
+            (trace_option->type == P_STRING && trace_option->value.s)) {
+            trace_file = trace_option->value.s;
+        }
     }
 
     // command line options
@@ -387,25 +456,195 @@ static void set_config(Mode *sw) {
     if (find_arg("-" REUSE_RESULT_OPTION) > -1)
         pd->config.reuse_result = TRUE;
 
+    if (find_arg("-" NO_DAEMON_OPTION) > -1)
+        pd->config.no_daemon = TRUE;
+
+    if (find_arg("-" PROGRESSIVE_OPTION) > -1)
+        pd->config.progressive = TRUE;
+
+    find_arg_uint("-" TIMEOUT_OPTION, &pd->config.timeout);
+    find_arg_uint("-" CPU_LIMIT_OPTION, &pd->config.cpu_limit);
+    find_arg_uint("-" MEMORY_LIMIT_OPTION, &pd->config.memory_limit);
+
     char *cmd = NULL;
     if (find_arg_str("-" CALC_COMMAND_OPTION, &cmd)) {
+        g_free(pd->cmd);
         pd->cmd = g_strdup(cmd);
     }
 
+    char *cmd_mode = NULL;
+    if (find_arg_str("-" CALC_COMMAND_MODE_OPTION, &cmd_mode)) {
+        pd->config.output_sink = parse_output_sink(cmd_mode);
+    }
+
     char *hint_result = NULL;
     if (find_arg_str("-" HINT_RESULT_OPTION, &hint_result)) {
+        g_free(pd->hint_result);
         pd->hint_result = g_strdup(hint_result);
     }
 
     char *hint_welcome = NULL;
     if (find_arg_str("-" HINT_WELCOME_OPTION, &hint_welcome)) {
+        g_free(pd->hint_welcome);
         pd->hint_welcome = g_strdup(hint_welcome);
     }
 
     char *calc_error_color = NULL;
     if (find_arg_str("-" CALC_ERROR_COLOR, &calc_error_color)) {
+        g_free(pd->calc_error_color);
         pd->calc_error_color = g_strdup(calc_error_color);
     }
+
+    char *representations = NULL;
+    if (find_arg_str("-" REPRESENTATIONS_OPTION, &representations)) {
+        set_representation_targets(pd, representations);
+    }
+
+    char *trace_arg = NULL;
+    if (find_arg_str("-" TRACE_OPTION, &trace_arg)) {
+        trace_file = trace_arg;
+    }
+
+    if (trace_file != NULL) {
+        pd->trace = trace_open(trace_file);
+    }
+
+    char *daemon_socket = NULL;
+    if (find_arg_str("-" DAEMON_SOCKET_OPTION, &daemon_socket)) {
+        g_free(pd->daemon_socket);
+        pd->daemon_socket = g_strdup(daemon_socket);
+    }
+
+    if (pd->config.no_daemon) {
+        g_free(pd->daemon_socket);
+        pd->daemon_socket = NULL;
+    } else if (pd->daemon_socket == NULL) {
+        pd->daemon_socket = protocol_socket_path();
+    }
+}
+
+// Stop talking to a daemon that doesn't answer, so every later request
+// doesn't hang on it again.
+static void daemon_check_timeout(CALCModePrivateData *pd, GError *error) {
+    if (error == NULL) {
+        return;
+    }
+
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_TIMED_OUT) &&
+        pd->daemon_socket != NULL) {
+        g_warning("Daemon at %s timed out, not using it anymore",
+                  pd->daemon_socket);
+        g_free(pd->daemon_socket);
+        pd->daemon_socket = NULL;
+    }
+    g_error_free(error);
+}
+
+// Connect to the daemon and send it the request `fields`. Reading the reply
+// times out after `reply_timeout` seconds, 0 waits forever.
+// Returns NULL if the daemon is disabled, isn't running or doesn't respond.
+static GSocketConnection *daemon_send(CALCModePrivateData *pd,
+                                      const gchar *const *fields,
+                                      guint reply_timeout) {
+    GError *error = NULL;
+
+    if (pd->daemon_socket == NULL) {
+        return NULL;
+    }
+
+    // Also applies to the write below.
+    GSocketClient *client = g_socket_client_new();
+    g_socket_client_set_timeout(client, DAEMON_TIMEOUT);
+    GSocketAddress *address = g_unix_socket_address_new(pd->daemon_socket);
+    GSocketConnection *connection = g_socket_client_connect(
+        client, G_SOCKET_CONNECTABLE(address), NULL, &error);
+    g_object_unref(address);
+    g_object_unref(client);
+
+    if (connection == NULL) {
+        daemon_check_timeout(pd, error);
+        return NULL;
+    }
+
+    gchar *line = protocol_join(fields);
+    GOutputStream *output =
+        g_io_stream_get_output_stream(G_IO_STREAM(connection));
+    gboolean sent = g_output_stream_write_all(output, line, strlen(line),
+                                              NULL, NULL, &error);
+    g_free(line);
+
+    if (!sent) {
+        daemon_check_timeout(pd, error);
+        g_object_unref(connection);
+        return NULL;
+    }
+
+    g_socket_set_timeout(g_socket_connection_get_socket(connection),
+                         reply_timeout);
+    return connection;
+}
+
+// Send a request to the daemon and wait for its reply.
+// Returns the reply fields, starting with `OK`, or NULL if the daemon is
+// unavailable or the request failed.
+static gchar **daemon_request(CALCModePrivateData *pd,
+                              const gchar *const *fields) {
+    GError *error = NULL;
+    GSocketConnection *connection = daemon_send(pd, fields, DAEMON_TIMEOUT);
+    if (connection == NULL) {
+        return NULL;
+    }
+
+    GDataInputStream *input = g_data_input_stream_new(
+        g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    char *line = g_data_input_stream_read_line(input, NULL, NULL, &error);
+    gchar **reply = NULL;
+
+    if (line == NULL) {
+        daemon_check_timeout(pd, error);
+    } else {
+        reply = protocol_split(line);
+        if (strcmp(reply[0], PROTOCOL_OK) != 0) {
+            g_warning("Daemon request %s failed: %s", fields[0],
+                      reply[1] != NULL ? reply[1] : "");
+            g_strfreev(reply);
+            reply = NULL;
+        }
+    }
+
+    g_free(line);
+    g_object_unref(input);
+    g_io_stream_close(G_IO_STREAM(connection), NULL, NULL);
+    g_object_unref(connection);
+    return reply;
+}
+
+// Persist `record`, through the daemon if it's running.
+static void persist_history_record(CALCModePrivateData *pd,
+                                   const HistoryRecord *record) {
+    gchar *line = history_record_serialize(record);
+    const gchar *fields[] = {PROTOCOL_HISTORY_ADD, line, NULL};
+    gchar **reply = daemon_request(pd, fields);
+
+    if (reply == NULL) {
+        append_record_to_history(record);
+    }
+    g_strfreev(reply);
+    g_free(line);
+}
+
+// Remove a persisted history record, through the daemon if it's running.
+static void remove_persisted_history_record(CALCModePrivateData *pd,
+                                            const HistoryRecord *record) {
+    gchar *line = history_record_serialize(record);
+    const gchar *fields[] = {PROTOCOL_HISTORY_DELETE, line, NULL};
+    gchar **reply = daemon_request(pd, fields);
+
+    if (reply == NULL) {
+        delete_record_from_history(record);
+    }
+    g_strfreev(reply);
+    g_free(line);
 }
 
 // Get the entries to display.
@@ -413,38 +652,29 @@ static void set_config(Mode *sw) {
 static void get_calc(Mode *sw) {
     CALCModePrivateData *pd = (CALCModePrivateData *)mode_get_private_data(sw);
     pd->last_result = g_strdup("");
-    pd->history = g_ptr_array_new();
+    pd->history = g_ptr_array_new_with_free_func(history_record_free);
+    pd->representations =
+        g_ptr_array_new_with_free_func(history_record_free);
     pd->previous_input = g_strdup(""); // providing initial value
 
     set_config(sw);
 
     if (!pd->config.no_history && !pd->config.no_persist_history) {
-        // Load old history if it exists.
-        GError *error = NULL;
-        gchar *history_file = g_build_filename(g_get_user_data_dir(), "rofi",
-                                               "rofi_calc_history", NULL);
-        gchar *history_contents;
-
-        if (g_file_test(history_file,
-                        G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR)) {
-            g_file_get_contents(history_file, &history_contents, NULL, &error);
-
-            if (error != NULL) {
-                g_error("Error while reading the history file: %s",
-                        error->message);
-                g_error_free(error);
-            }
-
-            char *newline = strtok(history_contents, "\n");
-
-            while (newline != NULL) {
-                g_ptr_array_add(pd->history, newline);
-
-                newline = strtok(NULL, "\n");
+        // Prefer the daemon's history store, it may be ahead of the file.
+        const gchar *fields[] = {PROTOCOL_HISTORY, NULL};
+        gchar **reply = daemon_request(pd, fields);
+
+        if (reply != NULL) {
+            for (gchar **entry = reply + 1; *entry != NULL; entry++) {
+                HistoryRecord *record = history_record_deserialize(*entry);
+                if (record != NULL) {
+                    g_ptr_array_add(pd->history, record);
+                }
             }
+            g_strfreev(reply);
+        } else {
+            load_history(pd->history);
         }
-
-        g_free(history_file);
     }
 }
 
@@ -466,7 +696,7 @@ static unsigned int calc_mode_get_num_entries(const Mode *sw) {
 
     // Add +1 because we put a static message into the history array as
     // well.
-    return pd->history->len + 1;
+    return pd->history->len + pd->representations->len + 1;
 }
 
 static gboolean is_error_string(char *str) {
@@ -478,102 +708,178 @@ static gboolean is_error_string(char *str) {
     return FALSE;
 }
 
-static int get_real_history_index(GPtrArray *history,
+// Representation rows come right after the static message, history
+// entries after them.
+static gboolean is_representation_line(const CALCModePrivateData *pd,
+                                       unsigned int selected_line) {
+    return selected_line > 0 && selected_line <= pd->representations->len;
+}
+
+static gboolean is_history_line(const CALCModePrivateData *pd,
+                                unsigned int selected_line) {
+    return selected_line > pd->representations->len &&
+           selected_line <= pd->representations->len + pd->history->len;
+}
+
+static int get_real_history_index(const CALCModePrivateData *pd,
                                   unsigned int selected_line) {
-    return history->len - selected_line;
+    return pd->history->len + pd->representations->len - selected_line;
 }
 
 static void append_last_result_to_history(CALCModePrivateData *pd) {
-    if (!is_error_string(pd->last_result) && strlen(pd->last_result) > 0) {
-        char *history_entry = g_strdup_printf("%s", pd->last_result);
-
-        // Replace newlines with semicolons so one entry isn't split into
-        // multiple entries
-        for (unsigned int i = 0; i < strlen(history_entry); i++) {
-            if (history_entry[i] == '\n') {
-                history_entry[i] = ';';
-            }
-        }
-
-        g_ptr_array_add(pd->history, (gpointer)history_entry);
+    if (pd->last_record != NULL) {
+        g_ptr_array_add(pd->history, history_record_copy(pd->last_record));
         if (!pd->config.no_persist_history) {
-            append_str_to_history(history_entry);
+            persist_history_record(pd, pd->last_record);
         }
     }
 }
 
-// Split the equation result into the left (expression) and right (result)
-// side of the equals sign.
-//
-// Note that both sides can themselves contain equals sign, consider the
-// simple example of `20x + 40 = 100`. This means we cannot naively split on
-// the '=' character.
-static char **split_equation(Mode *sw, char *string) {
-    CALCModePrivateData *pd = (CALCModePrivateData *)mode_get_private_data(sw);
-    char **result = malloc(2 * sizeof(char *));
-
-    if (pd->config.terse) {
-        result[0] = NULL;
-        result[1] = g_strdup(string); // with -terse, string _is_ the result
-        return result;
-    }
-
-    int parens_depth = 0;
-    char *curr = string + strlen(string);
-    int delimiter_len = 0;
-
-    // Iterate through and track our level of nestedness, stopping when
-    // we've hit an equals sign not inside other parentheses.
-    // At this point we can set the NULL character to split the string
-    // into `string` and `curr + delimiter_len`.
-    while (curr != string) {
-        curr--;
-        if (*curr == PARENS_RIGHT) {
-            parens_depth++;
-        } else if (*curr == PARENS_LEFT) {
-            parens_depth--;
-        } else if (parens_depth == 0) {
-            if (*curr == EQUALS_SIGN) {
-                delimiter_len = 1;
-                break;
-            } else if (!strncmp(curr, APPROX_SIGN, strlen(APPROX_SIGN))) {
-                delimiter_len = strlen(APPROX_SIGN);
-                break;
-            }
+// Append `str` to `out` as a JSON string literal, or `null` if it's NULL.
+static void append_json_string(GString *out, const char *str) {
+    if (str == NULL) {
+        g_string_append(out, "null");
+        return;
+    }
+
+    g_string_append_c(out, '"');
+    for (const char *c = str; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            g_string_append_c(out, '\\');
+            g_string_append_c(out, *c);
+        } else if (*c == '\n') {
+            g_string_append(out, "\\n");
+        } else if ((unsigned char)*c < 0x20) {
+            g_string_append_printf(out, "\\u%04x", (unsigned char)*c);
+        } else {
+            g_string_append_c(out, *c);
         }
     }
+    g_string_append_c(out, '"');
+}
 
-    if (curr == string) {
-        // No equals signs were found. Shouldn't happen, but if it does
-        // treat the entire expression as the result.
-        result[0] = NULL;
-        result[1] = g_strdup(string);
-    } else {
-        // We found an equals sign; set it to null to split the string in
-        // two.
-        *curr = '\0';
+// Format `record` as a single-line JSON object.
+static gchar *format_json_record(const HistoryRecord *record) {
+    GString *json = g_string_new("{\"expression\":");
+    append_json_string(json, record->expression);
+    g_string_append(json, ",\"result\":");
+    append_json_string(json, record->result);
+    g_string_append_printf(json, ",\"approximate\":%s}\n",
+                           record->approximate ? "true" : "false");
+    return g_string_free(json, FALSE);
+}
+
+// Run `cmd` without a shell. The template is split into an argv once and
+// the keys are substituted inside each argument, so the result never needs
+// escaping.
+static void exec_argv_template(char *cmd, const HistoryRecord *record) {
+    GError *error = NULL;
+    gchar **argv = NULL;
+
+    if (!g_shell_parse_argv(cmd, NULL, &argv, &error)) {
+        g_warning("Could not parse %s: %s", CALC_COMMAND_OPTION,
+                  error->message);
+        g_error_free(error);
+        return;
+    }
+
+    for (gchar **arg = argv; *arg != NULL; arg++) {
+        char *replaced = helper_string_replace_if_exists(
+            *arg, EQUATION_LHS_KEY, record->expression, EQUATION_RHS_KEY,
+            record->result, NULL);
+        g_free(*arg);
+        *arg = replaced;
+    }
+
+    g_spawn_async(NULL, argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL, NULL,
+                  &error);
+    if (error != NULL) {
+        g_warning("Spawning child failed: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_strfreev(argv);
+}
+
+// Write `record` to the FIFO at `path`. Opening is non-blocking so a FIFO
+// without a reader doesn't hang rofi on exit.
+static void write_to_fifo(const char *path, const char *record) {
+    int fd = open(path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        g_warning("Could not open FIFO '%s': %s", path, g_strerror(errno));
+        return;
+    }
+
+    if (write(fd, record, strlen(record)) < 0) {
+        g_warning("Could not write to FIFO '%s': %s", path, g_strerror(errno));
+    }
+    close(fd);
+}
+
+// Write `record` to the unix stream socket at `path`.
+static void write_to_socket(const char *path, const char *record) {
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        g_warning("Socket path '%s' is too long", path);
+        return;
+    }
+    strcpy(addr.sun_path, path);
 
-        // Strip trailing whitespace with `g_strchomp()` from the left.
-        // Strip leading whitespace with `g_strchug()` from the right.
-        result[0] = g_strchomp(string);
-        result[1] = g_strchug(curr + delimiter_len);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        g_warning("Could not create socket: %s", g_strerror(errno));
+        return;
     }
 
-    return result;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        g_warning("Could not connect to '%s': %s", path, g_strerror(errno));
+    } else if (write(fd, record, strlen(record)) < 0) {
+        g_warning("Could not write to '%s': %s", path, g_strerror(errno));
+    }
+    close(fd);
 }
 
-static void execsh(Mode *sw, char *cmd, char *entry) {
+static void execsh(Mode *sw, char *cmd, const HistoryRecord *record) {
+    CALCModePrivateData *pd = (CALCModePrivateData *)mode_get_private_data(sw);
+    CALCOutputSink sink = pd->config.output_sink;
+
     // If no command was provided, simply print the entry
-    if (cmd == NULL) {
+    if (cmd == NULL && sink != CALC_SINK_JSON) {
+        gchar *entry = history_record_format(record);
         printf("%s\n", entry);
+        g_free(entry);
+        return;
+    }
+
+    if (sink != CALC_SINK_SHELL) {
+        gchar *json = NULL;
+        switch (sink) {
+        case CALC_SINK_EXEC:
+            exec_argv_template(cmd, record);
+            break;
+        case CALC_SINK_FIFO:
+            json = format_json_record(record);
+            write_to_fifo(cmd, json);
+            break;
+        case CALC_SINK_SOCKET:
+            json = format_json_record(record);
+            write_to_socket(cmd, json);
+            break;
+        case CALC_SINK_JSON:
+            json = format_json_record(record);
+            fputs(json, stdout);
+            break;
+        case CALC_SINK_SHELL:
+            break;
+        }
+        g_free(json);
         return;
     }
 
     // Otherwise, we will execute -calc-command
-    char **parts = split_equation(sw, entry);
     char *user_cmd = helper_string_replace_if_exists(
-        cmd, EQUATION_LHS_KEY, parts[0], EQUATION_RHS_KEY, parts[1], NULL);
-    g_free(parts);
+        cmd, EQUATION_LHS_KEY, record->expression, EQUATION_RHS_KEY,
+        record->result, NULL);
 
     // don't escape these utf-8 runes which appear in qalc output, the escape
     // sequences are not recognized by shell (#108)
@@ -592,14 +898,31 @@ static ModeMode calc_mode_result(Mode *sw, int menu_entry,
                                  unsigned int selected_line) {
     ModeMode retv = MODE_EXIT;
     CALCModePrivateData *pd = (CALCModePrivateData *)mode_get_private_data(sw);
+
+    if (pd->trace != NULL) {
+        gchar *menu_entry_str = g_strdup_printf("%d", menu_entry);
+        gchar *selected_line_str = g_strdup_printf("%u", selected_line);
+        const gchar *fields[] = {TRACE_RESULT, menu_entry_str,
+                                 selected_line_str,
+                                 input != NULL && *input != NULL ? *input : "",
+                                 NULL};
+        trace_write(pd->trace, fields);
+        g_free(selected_line_str);
+        g_free(menu_entry_str);
+    }
+
     if (menu_entry & MENU_CUSTOM_COMMAND) {
         retv = (menu_entry & MENU_LOWER_MASK);
+    } else if ((menu_entry & MENU_OK) &&
+               is_representation_line(pd, selected_line)) {
+        execsh(sw, pd->cmd,
+               g_ptr_array_index(pd->representations, selected_line - 1));
+        retv = MODE_EXIT;
     } else if ((menu_entry & MENU_OK) &&
                (selected_line == 0 && !pd->config.no_history)) {
         append_last_result_to_history(pd);
         // Reuse Result: if result is valid, replace the input
-        if (pd->config.reuse_result &&
-            !is_error_string(pd->last_result) && strlen(pd->last_result) > 0) {
+        if (pd->config.reuse_result && pd->last_record != NULL) {
             if (input != NULL) {
                 *input = g_strdup(pd->last_result);
             }
@@ -607,40 +930,39 @@ static ModeMode calc_mode_result(Mode *sw, int menu_entry,
         retv = RELOAD_DIALOG;
     } else if ((menu_entry & MENU_OK) &&
                (selected_line > 0 || pd->config.no_history)) {
-        char *entry;
+        HistoryRecord *record = NULL;
         if (pd->config.no_history)
-            entry = pd->last_result;
-        else
-            entry = g_ptr_array_index(
-                pd->history,
-                get_real_history_index(pd->history, selected_line));
+            record = pd->last_record;
+        else if (is_history_line(pd, selected_line))
+            record = g_ptr_array_index(
+                pd->history, get_real_history_index(pd, selected_line));
 
-        execsh(sw, pd->cmd, entry);
-        retv = MODE_EXIT;
+        if (record != NULL) {
+            execsh(sw, pd->cmd, record);
+            retv = MODE_EXIT;
+        } else {
+            retv = RELOAD_DIALOG;
+        }
     } else if (menu_entry & MENU_CUSTOM_INPUT) {
-        if (!is_error_string(pd->last_result) && strlen(pd->last_result) > 0) {
+        if (pd->last_record != NULL) {
             if (!pd->config.no_history &&
                 find_arg("-" CALC_COMMAND_USES_HISTORY) != -1) {
-                char *history_entry = g_strdup_printf("%s", pd->last_result);
-                g_ptr_array_add(pd->history, (gpointer)history_entry);
-                if (!pd->config.no_persist_history) {
-                    append_str_to_history(history_entry);
-                }
+                append_last_result_to_history(pd);
             }
 
-            execsh(sw, pd->cmd, pd->last_result);
+            execsh(sw, pd->cmd, pd->last_record);
             retv = MODE_EXIT;
         } else {
             retv = RELOAD_DIALOG;
         }
     } else if (menu_entry & MENU_ENTRY_DELETE) {
-        if (selected_line > 0) {
-            g_ptr_array_remove_index(
-                pd->history,
-                get_real_history_index(pd->history, selected_line));
+        if (is_history_line(pd, selected_line)) {
+            guint index = get_real_history_index(pd, selected_line);
             if (!pd->config.no_persist_history && !pd->config.no_history) {
-                delete_line_from_history(selected_line - 1);
+                remove_persisted_history_record(
+                    pd, g_ptr_array_index(pd->history, index));
             }
+            g_ptr_array_remove_index(pd->history, index);
         }
         retv = RELOAD_DIALOG;
     }
@@ -657,6 +979,27 @@ static ModeMode calc_mode_result(Mode *sw, int menu_entry,
     return retv;
 }
 
+static void free_private_data(CALCModePrivateData *pd) {
+    g_free(pd->cmd);
+    g_free(pd->hint_result);
+    g_free(pd->hint_welcome);
+    g_free(pd->calc_error_color);
+    g_free(pd->last_result);
+    history_record_free(pd->last_record);
+    g_free(pd->previous_input);
+    g_free(pd->daemon_socket);
+    g_free(pd->pending_input);
+    g_free(pd->quick_input);
+    g_strfreev(pd->representation_targets);
+    if (pd->representations != NULL) {
+        g_ptr_array_unref(pd->representations);
+    }
+    if (pd->history != NULL) {
+        g_ptr_array_unref(pd->history);
+    }
+    g_free(pd);
+}
+
 static void calc_mode_destroy(Mode *sw) {
     CALCModePrivateData *pd = (CALCModePrivateData *)mode_get_private_data(sw);
 
@@ -664,7 +1007,29 @@ static void calc_mode_destroy(Mode *sw) {
         if (pd->config.automatic_save_to_history) {
             append_last_result_to_history(pd);
         }
-        g_free(pd);
+        if (pd->debounce_source != 0) {
+            g_source_remove(pd->debounce_source);
+            pd->debounce_source = 0;
+        }
+        if (pd->quick_source != 0) {
+            g_source_remove(pd->quick_source);
+            pd->quick_source = 0;
+        }
+        if (pd->trace != NULL) {
+            trace_close(pd->trace);
+            pd->trace = NULL;
+        }
+        g_debug("evaluations started: %u, skipped: %u, discarded: %u, "
+                "average latency: %" G_GINT64_FORMAT " us",
+                pd->evaluations_started, pd->evaluations_skipped,
+                pd->evaluations_discarded, pd->average_latency);
+
+        // Running evaluations still point at `pd`, the last one frees it.
+        if (pd->evaluations_in_flight > 0) {
+            pd->destroyed = TRUE;
+        } else {
+            free_private_data(pd);
+        }
         mode_set_private_data(sw, NULL);
     }
 }
@@ -685,9 +1050,14 @@ static char *calc_get_display_value(const Mode *sw, unsigned int selected_line,
         else
             return g_strdup("");
     }
-    unsigned int real_index =
-        get_real_history_index(pd->history, selected_line);
-    return g_strdup(g_ptr_array_index(pd->history, real_index));
+    if (is_representation_line(pd, selected_line)) {
+        HistoryRecord *record =
+            g_ptr_array_index(pd->representations, selected_line - 1);
+        return g_strdup(record->result);
+    }
+    unsigned int real_index = get_real_history_index(pd, selected_line);
+    return history_record_to_string(
+        g_ptr_array_index(pd->history, real_index));
 }
 
 static int calc_token_match(G_GNUC_UNUSED const Mode *sw,
@@ -699,99 +1069,484 @@ static int calc_token_match(G_GNUC_UNUSED const Mode *sw,
 // It's a hacky way of making rofi show new window titles.
 extern void rofi_view_reload(void);
 
-static void process_cb(GObject *source_object, GAsyncResult *res,
-                       gpointer user_data) {
-    GError *error = NULL;
-    GSubprocess *process = (GSubprocess *)source_object;
-    GInputStream *stdout_stream = g_subprocess_get_stdout_pipe(process);
-    char **last_result = (char **)user_data;
+static void get_evaluator_options(CALCModePrivateData *pd,
+                                  EvaluatorOptions *options) {
+    char *qalc_binary = "qalc";
+    if (find_arg(QALC_BINARY_OPTION) >= 0) {
+        find_arg_str(QALC_BINARY_OPTION, &qalc_binary);
+    }
 
-    g_subprocess_wait_check_finish(process, res, &error);
+    options->qalc_binary = qalc_binary;
+    options->terse = pd->config.terse;
+    options->no_unicode = pd->config.no_unicode;
+    options->quick = FALSE;
+    options->timeout = pd->config.timeout;
+    options->cpu_limit = pd->config.cpu_limit;
+    options->memory_limit = pd->config.memory_limit;
+}
 
-    if (error != NULL) {
-        // With qalculate >= 5.0.0, exit status 1 can mean bad (or
-        // incomplete) input
-        if (error->domain != G_SPAWN_EXIT_ERROR || error->code != 1) {
-            g_error("Process errored with: %s", error->message);
-        }
-        g_error_free(error);
-        error = NULL;
+// Replace the shown result. This is the only place qalc's output gets
+// parsed into a record. Preliminary results don't get one, so they can't
+// end up in history or be passed to `calc-command`.
+static void set_last_result(CALCModePrivateData *pd, char *result,
+                            gboolean preliminary) {
+    g_free(pd->last_result);
+    pd->last_result = result;
+    pd->last_result_is_preliminary = preliminary;
+
+    history_record_free(pd->last_record);
+    pd->last_record = NULL;
+    if (!preliminary && !is_error_string(result) && strlen(result) > 0) {
+        EvaluatorOptions options;
+        get_evaluator_options(pd, &options);
+        gchar *flags = protocol_format_flags(&options);
+        pd->last_record = history_record_new(result, options.terse, flags);
+        g_free(flags);
     }
 
-    gsize bytes_read = 0;
-    unsigned int stdout_bufsize = 4096;
-    char stdout_buf[stdout_bufsize];
-    g_input_stream_read_all(stdout_stream, stdout_buf, stdout_bufsize,
-                            &bytes_read, NULL, &error);
+    rofi_view_reload();
+}
 
-    if (error != NULL) {
-        g_error("Process errored with: %s", error->message);
-        g_error_free(error);
-        error = NULL;
+// What a request evaluates.
+typedef enum {
+    // The input itself, shown in the message line.
+    CALC_REQUEST_FULL,
+    // The quick phase of a progressive evaluation.
+    CALC_REQUEST_QUICK,
+    // The input converted to every target of `calc-representations`, batched
+    // into a single evaluation.
+    CALC_REQUEST_REPRESENTATIONS,
+} CALCRequestKind;
+
+// One evaluation started by `start_request`.
+typedef struct {
+    CALCModePrivateData *pd;
+    CALCRequestKind kind;
+    guint generation;
+    gchar **inputs;
+    gint64 started;
+} CalcRequest;
+
+static void calc_request_free(CalcRequest *request) {
+    g_strfreev(request->inputs);
+    g_free(request);
+}
+
+static void get_request_options(const CalcRequest *request,
+                                EvaluatorOptions *options) {
+    get_evaluator_options(request->pd, options);
+    options->quick = request->kind == CALC_REQUEST_QUICK;
+    // One line per representation, without the expression.
+    if (request->kind == CALC_REQUEST_REPRESENTATIONS) {
+        options->terse = TRUE;
+    }
+}
+
+// Order of a request's result. Within one generation the quick phase comes
+// before the full evaluation, so a late quick result can't replace it.
+static guint get_request_sequence(const CalcRequest *request) {
+    return request->generation * 2 +
+           (request->kind == CALC_REQUEST_QUICK ? 0 : 1);
+}
+
+// Replace the representation rows with the batched `output` of `request`,
+// one line per input. A NULL `output` just clears them.
+static void set_representations(const CalcRequest *request,
+                                const char *output) {
+    CALCModePrivateData *pd = request->pd;
+
+    g_ptr_array_set_size(pd->representations, 0);
+    if (output == NULL) {
+        rofi_view_reload();
+        return;
     }
 
-    *last_result = g_strndup(stdout_buf, bytes_read - 1);
-    g_input_stream_close(stdout_stream, NULL, &error);
+    gchar **lines = g_strsplit(output, "\n", -1);
+    if (g_strv_length(lines) == g_strv_length(request->inputs)) {
+        EvaluatorOptions options;
+        get_request_options(request, &options);
+        gchar *flags = protocol_format_flags(&options);
 
-    if (error != NULL) {
-        g_error("Process errored with: %s", error->message);
-        g_error_free(error);
-        error = NULL;
+        for (guint i = 0; lines[i] != NULL; i++) {
+            if (is_error_string(lines[i]) || *lines[i] == '\0') {
+                continue;
+            }
+            HistoryRecord *record = history_record_new(lines[i], TRUE, flags);
+            record->expression = g_strdup(request->inputs[i]);
+            g_ptr_array_add(pd->representations, record);
+        }
+
+        g_free(flags);
+    } else {
+        g_debug("Expected %u representations, got: %s",
+                g_strv_length(request->inputs), output);
     }
 
+    g_strfreev(lines);
     rofi_view_reload();
 }
 
-static char *calc_preprocess_input(Mode *sw, const char *input) {
+// Record a finished evaluation in the session trace.
+static void trace_evaluation(const CalcRequest *request,
+                             EvaluatorStatus status, gint64 latency,
+                             const char *result) {
+    static const char *kinds[] = {
+        [CALC_REQUEST_FULL] = "full",
+        [CALC_REQUEST_QUICK] = "quick",
+        [CALC_REQUEST_REPRESENTATIONS] = "representations",
+    };
+    gchar *status_str = protocol_format_status(status);
+    gchar *latency_str = g_strdup_printf("%" G_GINT64_FORMAT, latency);
+    GPtrArray *fields = g_ptr_array_new();
+
+    g_ptr_array_add(fields, TRACE_EVALUATION);
+    g_ptr_array_add(fields, (gpointer)kinds[request->kind]);
+    g_ptr_array_add(fields, status_str);
+    g_ptr_array_add(fields, latency_str);
+    g_ptr_array_add(fields, (gpointer)result);
+    for (gchar **input = request->inputs; *input != NULL; input++) {
+        g_ptr_array_add(fields, *input);
+    }
+    g_ptr_array_add(fields, NULL);
+
+    trace_write(request->pd->trace, (const gchar *const *)fields->pdata);
+
+    g_ptr_array_free(fields, TRUE);
+    g_free(latency_str);
+    g_free(status_str);
+}
+
+static void start_pending_evaluation(CALCModePrivateData *pd);
+
+// The full evaluation finished or was superseded, no quick phase needed.
+static void cancel_quick_phase(CALCModePrivateData *pd) {
+    if (pd->quick_source != 0) {
+        g_source_remove(pd->quick_source);
+        pd->quick_source = 0;
+    }
+    g_free(pd->quick_input);
+    pd->quick_input = NULL;
+}
+
+static void evaluation_done_cb(EvaluatorStatus status, char *result,
+                               gpointer user_data) {
+    CalcRequest *request = (CalcRequest *)user_data;
+    CALCModePrivateData *pd = request->pd;
+    gint64 latency = g_get_monotonic_time() - request->started;
+
+    // Nobody is left to show the result to.
+    if (pd->destroyed) {
+        if (--pd->evaluations_in_flight == 0) {
+            free_private_data(pd);
+        }
+        g_free(result);
+        calc_request_free(request);
+        return;
+    }
+
+    if (pd->trace != NULL) {
+        trace_evaluation(request, status, latency, result);
+    }
+
+    // Other kinds are capped or batched, they'd only skew the average.
+    if (request->kind == CALC_REQUEST_FULL) {
+        if (pd->average_latency == 0) {
+            pd->average_latency = latency;
+        } else {
+            pd->average_latency +=
+                (latency - pd->average_latency) / LATENCY_AVERAGE_WEIGHT;
+        }
+        if (request->generation == pd->generation) {
+            cancel_quick_phase(pd);
+        }
+    }
+    pd->evaluations_in_flight--;
+
+    guint sequence = get_request_sequence(request);
+    if (request->kind == CALC_REQUEST_REPRESENTATIONS) {
+        // Only the latest input's representations are worth showing.
+        if (request->generation == pd->generation) {
+            set_representations(request,
+                                status == EVALUATOR_DONE ? result : NULL);
+        } else {
+            pd->evaluations_discarded++;
+        }
+        g_free(result);
+    } else if (request->kind == CALC_REQUEST_QUICK &&
+               status != EVALUATOR_DONE) {
+        // The quick phase ran out of time, the full evaluation will tell.
+        g_free(result);
+    } else if (sequence > pd->shown_sequence) {
+        pd->shown_sequence = sequence;
+        set_last_result(pd, result, request->kind == CALC_REQUEST_QUICK);
+    } else {
+        // A newer input finished first, this result is stale.
+        pd->evaluations_discarded++;
+        g_free(result);
+    }
+
+    // Whatever was held back is the latest input, don't wait for the timer.
+    // Quick and representation results don't mean qalc is free again.
+    if (request->kind == CALC_REQUEST_FULL && pd->pending_input != NULL) {
+        start_pending_evaluation(pd);
+    }
+    calc_request_free(request);
+}
+
+// An evaluation that was handed to the daemon.
+typedef struct {
+    CalcRequest *request;
+    GSocketConnection *connection;
+    GDataInputStream *reply_stream;
+} DaemonEvaluation;
+
+static void daemon_evaluation_cb(GObject *source_object, GAsyncResult *res,
+                                 gpointer user_data) {
+    DaemonEvaluation *evaluation = (DaemonEvaluation *)user_data;
     GError *error = NULL;
-    CALCModePrivateData *pd = (CALCModePrivateData *)mode_get_private_data(sw);
 
-    if (strcmp(input, pd->previous_input) == 0) {
-        return g_strdup(pd->previous_input);
+    char *line = g_data_input_stream_read_line_finish(
+        G_DATA_INPUT_STREAM(source_object), res, NULL, &error);
+    gchar **reply = line != NULL ? protocol_split(line) : NULL;
+    daemon_check_timeout(evaluation->request->pd, error);
+
+    if (reply != NULL && g_strv_length(reply) == 3 &&
+        strcmp(reply[0], PROTOCOL_OK) == 0) {
+        evaluation_done_cb(protocol_parse_status(reply[1]),
+                           g_strdup(reply[2]), evaluation->request);
+    } else if (evaluation->request->pd->destroyed) {
+        // Not worth evaluating in-process anymore.
+        evaluation_done_cb(EVALUATOR_ABORTED, g_strdup(""),
+                           evaluation->request);
+    } else {
+        // The daemon went away or stalled mid-request, evaluate in-process
+        // instead.
+        EvaluatorOptions options;
+        get_request_options(evaluation->request, &options);
+        evaluator_run(&options,
+                      (const char *const *)evaluation->request->inputs,
+                      evaluation_done_cb, evaluation->request);
     }
 
-    g_free(pd->previous_input);
-    pd->previous_input = g_strdup(input);
+    g_strfreev(reply);
+    g_free(line);
+    g_io_stream_close(G_IO_STREAM(evaluation->connection), NULL, NULL);
+    g_object_unref(evaluation->reply_stream);
+    g_object_unref(evaluation->connection);
+    g_free(evaluation);
+}
 
-    char *qalc_binary = "qalc";
-    if (find_arg(QALC_BINARY_OPTION) >= 0) {
-        find_arg_str(QALC_BINARY_OPTION, &qalc_binary);
+// Hand `request` to the daemon. Returns FALSE if it isn't running.
+static gboolean daemon_evaluate(CalcRequest *request,
+                                const EvaluatorOptions *options) {
+    GPtrArray *fields = g_ptr_array_new();
+    gchar *flags = protocol_format_flags(options);
+    gchar *limits = protocol_format_limits(options);
+
+    g_ptr_array_add(fields, PROTOCOL_EVAL);
+    g_ptr_array_add(fields, flags);
+    g_ptr_array_add(fields, limits);
+    g_ptr_array_add(fields, (gpointer)options->qalc_binary);
+    for (gchar **input = request->inputs; *input != NULL; input++) {
+        g_ptr_array_add(fields, *input);
+    }
+    g_ptr_array_add(fields, NULL);
+
+    // Give the daemon as long as qalc may take, plus some slack.
+    guint reply_timeout =
+        options->timeout > 0
+            ? (options->timeout + 999) / 1000 + DAEMON_TIMEOUT
+            : 0;
+    GSocketConnection *connection = daemon_send(
+        request->pd, (const gchar *const *)fields->pdata, reply_timeout);
+    g_ptr_array_free(fields, TRUE);
+    g_free(limits);
+    g_free(flags);
+
+    if (connection == NULL) {
+        return FALSE;
+    }
+
+    DaemonEvaluation *evaluation = g_new0(DaemonEvaluation, 1);
+    evaluation->request = request;
+    evaluation->connection = connection;
+    evaluation->reply_stream = g_data_input_stream_new(
+        g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+
+    g_data_input_stream_read_line_async(evaluation->reply_stream,
+                                        G_PRIORITY_DEFAULT, NULL,
+                                        daemon_evaluation_cb, evaluation);
+    return TRUE;
+}
+
+// Start evaluating `inputs`, taking ownership of them.
+static void start_request(CALCModePrivateData *pd, CALCRequestKind kind,
+                          guint generation, gchar **inputs) {
+    CalcRequest *request = g_new0(CalcRequest, 1);
+    request->pd = pd;
+    request->kind = kind;
+    request->generation = generation;
+    request->inputs = inputs;
+    request->started = g_get_monotonic_time();
+    pd->evaluations_in_flight++;
+    pd->evaluations_started++;
+
+    EvaluatorOptions options;
+    get_request_options(request, &options);
+
+    if (!daemon_evaluate(request, &options)) {
+        evaluator_run(&options, (const char *const *)request->inputs,
+                      evaluation_done_cb, request);
+    }
+}
+
+// Start the batched evaluation of every representation of `input`.
+static void start_representations(CALCModePrivateData *pd, const char *input,
+                                  guint generation) {
+    if (*input == '\0') {
+        return;
     }
 
-    // Build array of strings that is later fed into a subprocess to actually
-    // start qalc with proper parameters.
-    GPtrArray *argv = g_ptr_array_new();
-    g_ptr_array_add(argv, qalc_binary);
-    g_ptr_array_add(argv, "-s");
-    g_ptr_array_add(argv, "update_exchange_rates 1days");
-    if (pd->config.terse) {
-        g_ptr_array_add(argv, "-t");
+    guint count = g_strv_length(pd->representation_targets);
+    gchar **inputs = g_new0(gchar *, count + 1);
+    for (guint i = 0; i < count; i++) {
+        inputs[i] = g_strdup_printf("%s to %s", input,
+                                    pd->representation_targets[i]);
     }
-    if (!pd->config.no_unicode) {
-        g_ptr_array_add(argv, "+u8");
+
+    start_request(pd, CALC_REQUEST_REPRESENTATIONS, generation, inputs);
+}
+
+// Mark the result on screen as outdated while the full evaluation of a newer
+// input is taking a while, so it isn't mistaken for that input's result.
+static void show_pending_result(CALCModePrivateData *pd) {
+    if (pd->last_result_is_preliminary) {
+        return;
     }
-    g_ptr_array_add(argv, (gchar *)input);
-    g_ptr_array_add(argv, NULL);
 
-    GSubprocess *process = g_subprocess_newv(
-        (const gchar **)(argv->pdata),
-        G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_MERGE,
-        &error);
-    g_ptr_array_free(argv, TRUE);
+    pd->last_result_is_preliminary = TRUE;
+    history_record_free(pd->last_record);
+    pd->last_record = NULL;
+    rofi_view_reload();
+}
 
-    if (error != NULL) {
-        g_error("Spawning child failed: %s", error->message);
-        g_error_free(error);
+static gboolean quick_phase_cb(gpointer user_data) {
+    CALCModePrivateData *pd = (CALCModePrivateData *)user_data;
+    gchar **inputs = g_new0(gchar *, 2);
+
+    inputs[0] = pd->quick_input;
+    pd->quick_input = NULL;
+    pd->quick_source = 0;
+    show_pending_result(pd);
+    start_request(pd, CALC_REQUEST_QUICK, pd->generation, inputs);
+
+    return G_SOURCE_REMOVE;
+}
+
+// Evaluate `pd->pending_input` right away. With progressive results
+// enabled, a quick approximate evaluation is added if the full one is still
+// running after `PROGRESSIVE_DELAY` ms, to have something to show early.
+static void start_pending_evaluation(CALCModePrivateData *pd) {
+    if (pd->debounce_source != 0) {
+        g_source_remove(pd->debounce_source);
+        pd->debounce_source = 0;
+    }
+
+    char *input = pd->pending_input;
+    pd->pending_input = NULL;
+
+    guint generation = ++pd->generation;
+    cancel_quick_phase(pd);
+
+    // Rows of the previous input mustn't be picked for this one.
+    if (pd->representations->len > 0) {
+        g_ptr_array_set_size(pd->representations, 0);
+        rofi_view_reload();
+    }
+    if (pd->config.progressive) {
+        pd->quick_input = g_strdup(input);
+        pd->quick_source =
+            g_timeout_add(PROGRESSIVE_DELAY, quick_phase_cb, pd);
+    }
+    if (pd->representation_targets != NULL) {
+        start_representations(pd, input, generation);
+    }
+
+    const gchar *inputs[] = {input, NULL};
+    start_request(pd, CALC_REQUEST_FULL, generation,
+                  g_strdupv((gchar **)inputs));
+
+    g_free(input);
+}
+
+static gboolean debounce_cb(gpointer user_data) {
+    CALCModePrivateData *pd = (CALCModePrivateData *)user_data;
+
+    pd->debounce_source = 0;
+    start_pending_evaluation(pd);
+
+    return G_SOURCE_REMOVE;
+}
+
+// How long to hold back a new input, in milliseconds.
+static guint get_debounce_delay(CALCModePrivateData *pd) {
+    gint64 latency = pd->average_latency / 1000;
+
+    if (latency < DEBOUNCE_MIN_LATENCY) {
+        return 0;
+    }
+    return MIN(latency / 2, DEBOUNCE_MAX);
+}
+
+// Evaluate `input`, coalescing inputs that arrive while qalc is still busy.
+// Only the latest of those is evaluated, as soon as the running evaluation
+// finishes or the debounce delay passes, whichever comes first.
+static void schedule_evaluation(CALCModePrivateData *pd, const char *input) {
+    if (pd->pending_input != NULL) {
+        pd->evaluations_skipped++;
+    }
+    g_free(pd->pending_input);
+    pd->pending_input = g_strdup(input);
+
+    guint delay = get_debounce_delay(pd);
+    if (pd->evaluations_in_flight == 0 || delay == 0) {
+        start_pending_evaluation(pd);
+    } else if (pd->debounce_source == 0) {
+        pd->debounce_source = g_timeout_add(delay, debounce_cb, pd);
+    }
+}
+
+static char *calc_preprocess_input(Mode *sw, const char *input) {
+    CALCModePrivateData *pd = (CALCModePrivateData *)mode_get_private_data(sw);
+
+    if (pd->trace != NULL) {
+        const gchar *fields[] = {TRACE_INPUT, input, NULL};
+        trace_write(pd->trace, fields);
     }
 
-    g_subprocess_wait_check_async(process, NULL, process_cb,
-                                  (gpointer)&pd->last_result);
+    if (strcmp(input, pd->previous_input) == 0) {
+        return g_strdup(pd->previous_input);
+    }
+
+    g_free(pd->previous_input);
+    pd->previous_input = g_strdup(input);
+
+    schedule_evaluation(pd, input);
 
     return g_strdup(input);
 }
 
 static char *calc_get_message(const Mode *sw) {
     CALCModePrivateData *pd = (CALCModePrivateData *)mode_get_private_data(sw);
+    if (pd->last_result_is_preliminary) {
+        // Not bold and trailed by an ellipsis until the full result is in.
+        if (!*pd->last_result) {
+            return g_markup_printf_escaped("%s…", pd->hint_result);
+        }
+        return g_markup_printf_escaped("%s<i>%s</i> …", pd->hint_result,
+                                       pd->last_result);
+    }
+
     if (is_error_string(pd->last_result)) {
         return g_markup_printf_escaped("<span foreground='%s'>%s</span>",
                                        pd->calc_error_color, pd->last_result);
@@ -0,0 +1,438 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// rofi-calcd: a resident daemon that outlives single rofi launches.
+//
+// It owns the result cache and the history store and evaluates inputs on
+// behalf of the plugin, with qalc processes it keeps running in between. The plugin talks to it over a unix socket (see
+// `protocol.h`) and falls back to doing everything itself when the daemon
+// isn't running.
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib-unix.h>
+#include <glib.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "evaluator.h"
+#include "history.h"
+#include "protocol.h"
+#include "resident.h"
+
+// Seconds a cached result is served before qalc is asked again. Inputs such
+// as `now` or currency conversions change over time, so keep this short.
+#define DEFAULT_CACHE_TTL 30
+
+// Upper bound on cached results. The cache is simply flushed when full.
+#define CACHE_SIZE 1024
+
+// Upper bound on resident qalc processes, one per combination of binary,
+// flags and memory limit. All are stopped when a new one doesn't fit.
+#define RESIDENT_COUNT 4
+
+typedef struct {
+    gint64 cache_ttl;
+    gboolean no_persist_history;
+    // Maps the joined flags and inputs of a request to a `CacheEntry`.
+    GHashTable *cache;
+    // Maps the binary, flags and memory limit of a request to a
+    // `ResidentEvaluator`.
+    GHashTable *residents;
+    GPtrArray *history;
+} Daemon;
+
+typedef struct {
+    char *result;
+    gint64 created;
+} CacheEntry;
+
+// A connected client. Every connection carries exactly one request.
+typedef struct {
+    Daemon *daemon;
+    GSocketConnection *connection;
+    GDataInputStream *input;
+    char *cache_key;
+} Client;
+
+static void cache_entry_free(gpointer data) {
+    CacheEntry *entry = (CacheEntry *)data;
+    g_free(entry->result);
+    g_free(entry);
+}
+
+static void client_free(Client *client) {
+    g_io_stream_close(G_IO_STREAM(client->connection), NULL, NULL);
+    g_object_unref(client->input);
+    g_object_unref(client->connection);
+    g_free(client->cache_key);
+    g_free(client);
+}
+
+// Send the reply `fields` and close the connection.
+static void client_reply(Client *client, const gchar *const *fields) {
+    GError *error = NULL;
+    gchar *line = protocol_join(fields);
+    GOutputStream *output =
+        g_io_stream_get_output_stream(G_IO_STREAM(client->connection));
+
+    g_output_stream_write_all(output, line, strlen(line), NULL, NULL, &error);
+    if (error != NULL) {
+        g_warning("Could not reply to client: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_free(line);
+    client_free(client);
+}
+
+static void client_reply_error(Client *client, const gchar *message) {
+    const gchar *fields[] = {PROTOCOL_ERR, message, NULL};
+    client_reply(client, fields);
+}
+
+static void evaluation_cb(EvaluatorStatus status, char *result,
+                          gpointer user_data) {
+    Client *client = (Client *)user_data;
+    Daemon *daemon = client->daemon;
+
+    // Likely a bad `--qalc-binary`. Let the client evaluate on its own, the
+    // daemon keeps serving.
+    if (status == EVALUATOR_FAILED) {
+        g_warning("Evaluation failed: %s", result);
+        client_reply_error(client, result);
+        g_free(result);
+        return;
+    }
+
+    // Killed evaluations may well finish next time, don't remember them.
+    if (status == EVALUATOR_DONE) {
+        if (g_hash_table_size(daemon->cache) >= CACHE_SIZE) {
+            g_hash_table_remove_all(daemon->cache);
+        }
+
+        CacheEntry *entry = g_new0(CacheEntry, 1);
+        entry->result = g_strdup(result);
+        entry->created = g_get_monotonic_time();
+        g_hash_table_insert(daemon->cache, g_strdup(client->cache_key),
+                            entry);
+    }
+
+    gchar *status_str = protocol_format_status(status);
+    const gchar *fields[] = {PROTOCOL_OK, status_str, result, NULL};
+    client_reply(client, fields);
+    g_free(status_str);
+    g_free(result);
+}
+
+static void handle_eval(Client *client, gchar **request) {
+    Daemon *daemon = client->daemon;
+
+    EvaluatorOptions options = {0};
+    if (g_strv_length(request) < 5 ||
+        !protocol_parse_limits(request[2], &options)) {
+        client_reply_error(client,
+                           "EVAL takes flags, limits, qalc binary and inputs");
+        return;
+    }
+    protocol_parse_flags(request[1], &options);
+    options.qalc_binary = request[3];
+
+    // Requests with different binaries or limits are cached apart.
+
+    client->cache_key = protocol_join((const gchar *const *)request + 1);
+    CacheEntry *entry = g_hash_table_lookup(daemon->cache, client->cache_key);
+    if (entry != NULL && g_get_monotonic_time() - entry->created <
+                             daemon->cache_ttl * G_USEC_PER_SEC) {
+        gchar *status_str = protocol_format_status(EVALUATOR_DONE);
+        const gchar *fields[] = {PROTOCOL_OK, status_str, entry->result,
+                                 NULL};
+        client_reply(client, fields);
+        g_free(status_str);
+        return;
+    }
+
+    // CPU time adds up over a process' lifetime, so CPU limited evaluations
+    // each get a qalc of their own.
+    if (options.cpu_limit > 0) {
+        evaluator_run(&options, (const char *const *)request + 4,
+                      evaluation_cb, client);
+        return;
+    }
+
+    gchar *resident_key = g_strdup_printf("%s\t%u\t%s", request[1],
+                                          options.memory_limit, request[3]);
+    ResidentEvaluator *resident =
+        g_hash_table_lookup(daemon->residents, resident_key);
+    if (resident == NULL) {
+        if (g_hash_table_size(daemon->residents) >= RESIDENT_COUNT) {
+            g_hash_table_remove_all(daemon->residents);
+        }
+        resident = resident_evaluator_new(&options);
+        g_hash_table_insert(daemon->residents, resident_key, resident);
+    } else {
+        g_free(resident_key);
+    }
+
+    resident_evaluator_run(resident, &options,
+                           (const char *const *)request + 4, evaluation_cb,
+                           client);
+}
+
+static void handle_history(Client *client) {
+    GPtrArray *history = client->daemon->history;
+    GPtrArray *fields = g_ptr_array_new();
+
+    g_ptr_array_add(fields, PROTOCOL_OK);
+    for (guint i = 0; i < history->len; i++) {
+        g_ptr_array_add(fields, history_record_serialize(
+                                    g_ptr_array_index(history, i)));
+    }
+    g_ptr_array_add(fields, NULL);
+
+    client_reply(client, (const gchar *const *)fields->pdata);
+    for (guint i = 1; i < fields->len - 1; i++) {
+        g_free(g_ptr_array_index(fields, i));
+    }
+    g_ptr_array_free(fields, TRUE);
+}
+
+static void handle_history_add(Client *client, gchar **request) {
+    Daemon *daemon = client->daemon;
+
+    HistoryRecord *record = g_strv_length(request) == 2
+                                ? history_record_deserialize(request[1])
+                                : NULL;
+    if (record == NULL) {
+        client_reply_error(client, "HISTORY_ADD takes a history record");
+        return;
+    }
+
+    g_ptr_array_add(daemon->history, record);
+    if (daemon->history->len > HISTORY_LENGTH) {
+        g_ptr_array_remove_index(daemon->history, 0);
+    }
+    if (!daemon->no_persist_history) {
+        append_record_to_history(record);
+    }
+
+    const gchar *fields[] = {PROTOCOL_OK, NULL};
+    client_reply(client, fields);
+}
+
+static void handle_history_delete(Client *client, gchar **request) {
+    Daemon *daemon = client->daemon;
+
+    HistoryRecord *record = g_strv_length(request) == 2
+                                ? history_record_deserialize(request[1])
+                                : NULL;
+    if (record == NULL) {
+        client_reply_error(client, "HISTORY_DELETE takes a history record");
+        return;
+    }
+
+    // The file is checked even if memory had no match, it may hold records
+    // written by a plugin while the daemon wasn't running.
+    remove_record_from(daemon->history, record);
+    if (!daemon->no_persist_history) {
+        delete_record_from_history(record);
+    }
+    history_record_free(record);
+
+    const gchar *fields[] = {PROTOCOL_OK, NULL};
+    client_reply(client, fields);
+}
+
+static void read_request_cb(GObject *source_object, GAsyncResult *res,
+                            gpointer user_data) {
+    Client *client = (Client *)user_data;
+    GError *error = NULL;
+
+    char *line = g_data_input_stream_read_line_finish(
+        G_DATA_INPUT_STREAM(source_object), res, NULL, &error);
+
+    if (line == NULL) {
+        if (error != NULL) {
+            g_warning("Could not read request: %s", error->message);
+            g_error_free(error);
+        }
+        client_free(client);
+        return;
+    }
+
+    gchar **request = protocol_split(line);
+    g_free(line);
+
+    if (strcmp(request[0], PROTOCOL_EVAL) == 0) {
+        handle_eval(client, request);
+    } else if (strcmp(request[0], PROTOCOL_HISTORY) == 0) {
+        handle_history(client);
+    } else if (strcmp(request[0], PROTOCOL_HISTORY_ADD) == 0) {
+        handle_history_add(client, request);
+    } else if (strcmp(request[0], PROTOCOL_HISTORY_DELETE) == 0) {
+        handle_history_delete(client, request);
+    } else {
+        client_reply_error(client, "Unknown request");
+    }
+
+    g_strfreev(request);
+}
+
+static gboolean incoming_cb(G_GNUC_UNUSED GSocketService *service,
+                            GSocketConnection *connection,
+                            G_GNUC_UNUSED GObject *source_object,
+                            gpointer user_data) {
+    Client *client = g_new0(Client, 1);
+    client->daemon = (Daemon *)user_data;
+    client->connection = g_object_ref(connection);
+    client->input = g_data_input_stream_new(
+        g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+
+    g_data_input_stream_read_line_async(client->input, G_PRIORITY_DEFAULT,
+                                        NULL, read_request_cb, client);
+    return TRUE;
+}
+
+// Remove a socket left behind by a daemon that didn't exit cleanly. Returns
+// FALSE if another daemon is still listening on it.
+static gboolean remove_stale_socket(const gchar *socket_path) {
+    if (!g_file_test(socket_path, G_FILE_TEST_EXISTS)) {
+        return TRUE;
+    }
+
+    GSocketClient *socket_client = g_socket_client_new();
+    GSocketAddress *address = g_unix_socket_address_new(socket_path);
+    GSocketConnection *connection = g_socket_client_connect(
+        socket_client, G_SOCKET_CONNECTABLE(address), NULL, NULL);
+    g_object_unref(address);
+    g_object_unref(socket_client);
+
+    if (connection != NULL) {
+        g_object_unref(connection);
+        return FALSE;
+    }
+
+    unlink(socket_path);
+    return TRUE;
+}
+
+static gboolean quit_cb(gpointer user_data) {
+    g_main_loop_quit((GMainLoop *)user_data);
+    return G_SOURCE_REMOVE;
+}
+
+int main(int argc, char **argv) {
+    GError *error = NULL;
+    gchar *socket_path = NULL;
+    gint cache_ttl = DEFAULT_CACHE_TTL;
+    gboolean no_persist_history = FALSE;
+
+    GOptionEntry entries[] = {
+        {"socket", 0, 0, G_OPTION_ARG_FILENAME, &socket_path,
+         "Listen on PATH instead of $XDG_RUNTIME_DIR/" PROTOCOL_SOCKET_NAME,
+         "PATH"},
+        {"cache-ttl", 0, 0, G_OPTION_ARG_INT, &cache_ttl,
+         "Seconds a cached result stays valid", "SECONDS"},
+        {"no-persist-history", 0, 0, G_OPTION_ARG_NONE, &no_persist_history,
+         "Keep history in memory only", NULL},
+        {NULL, 0, 0, 0, NULL, NULL, NULL},
+    };
+
+    GOptionContext *context = g_option_context_new("- rofi-calc daemon");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (socket_path == NULL) {
+        socket_path = protocol_socket_path();
+    }
+
+    if (!remove_stale_socket(socket_path)) {
+        g_printerr("Another daemon is already listening on %s\n",
+                   socket_path);
+        return EXIT_FAILURE;
+    }
+
+    Daemon daemon = {
+        .cache_ttl = cache_ttl,
+        .no_persist_history = no_persist_history,
+        .cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                       cache_entry_free),
+        .residents = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+                                           resident_evaluator_free),
+        .history = g_ptr_array_new_with_free_func(history_record_free),
+    };
+
+    if (!no_persist_history) {
+        load_history(daemon.history);
+    }
+
+    // Only the current user may talk to the daemon.
+    mode_t old_umask = umask(0077);
+    GSocketService *service = g_socket_service_new();
+    GSocketAddress *address = g_unix_socket_address_new(socket_path);
+    g_socket_listener_add_address(G_SOCKET_LISTENER(service), address,
+                                  G_SOCKET_TYPE_STREAM,
+                                  G_SOCKET_PROTOCOL_DEFAULT, NULL, NULL,
+                                  &error);
+    g_object_unref(address);
+    umask(old_umask);
+
+    if (error != NULL) {
+        g_printerr("Could not listen on %s: %s\n", socket_path,
+                   error->message);
+        g_error_free(error);
+        return EXIT_FAILURE;
+    }
+
+    // Writing to a qalc that just died must not take the daemon down.
+    signal(SIGPIPE, SIG_IGN);
+
+    g_signal_connect(service, "incoming", G_CALLBACK(incoming_cb), &daemon);
+    g_socket_service_start(service);
+
+    GMainLoop *loop = g_main_loop_new(NULL, FALSE);
+    g_unix_signal_add(SIGINT, quit_cb, loop);
+    g_unix_signal_add(SIGTERM, quit_cb, loop);
+    g_main_loop_run(loop);
+
+    unlink(socket_path);
+    g_main_loop_unref(loop);
+    g_object_unref(service);
+    g_hash_table_unref(daemon.residents);
+    g_hash_table_unref(daemon.cache);
+    g_ptr_array_unref(daemon.history);
+    g_free(socket_path);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,242 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "evaluator.h"
+
+#include <gio/gio.h>
+#include <sys/resource.h>
+
+#define SPAWN_FAILED_MESSAGE "error: could not run %s: %s"
+#define EXIT_STATUS_MESSAGE "error: %s exited with status %d"
+#define COMMUNICATE_MESSAGE "error: evaluation aborted: %s"
+
+// An evaluation that is currently running.
+typedef struct {
+    EvaluatorCallback callback;
+    gpointer user_data;
+    GSubprocess *process;
+    char *qalc_binary;
+    // Error message when qalc couldn't be started.
+    char *spawn_error;
+    guint timeout;
+    guint timeout_source;
+    gboolean timed_out;
+    struct rlimit cpu_limit;
+    struct rlimit memory_limit;
+} Evaluation;
+
+// Runs in the child between fork and exec, so only async-signal-safe calls
+// are allowed here.
+static void apply_limits(gpointer user_data) {
+    Evaluation *evaluation = (Evaluation *)user_data;
+
+    if (evaluation->cpu_limit.rlim_cur > 0) {
+        setrlimit(RLIMIT_CPU, &evaluation->cpu_limit);
+    }
+    if (evaluation->memory_limit.rlim_cur > 0) {
+        setrlimit(RLIMIT_AS, &evaluation->memory_limit);
+    }
+}
+
+static gboolean timeout_cb(gpointer user_data) {
+    Evaluation *evaluation = (Evaluation *)user_data;
+
+    evaluation->timeout_source = 0;
+    evaluation->timed_out = TRUE;
+    g_subprocess_force_exit(evaluation->process);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void evaluation_free(Evaluation *evaluation) {
+    g_free(evaluation->qalc_binary);
+    g_free(evaluation->spawn_error);
+    g_free(evaluation);
+}
+
+// Report a failed spawn from the main loop, like any other result.
+static gboolean spawn_failed_cb(gpointer user_data) {
+    Evaluation *evaluation = (Evaluation *)user_data;
+
+    evaluation->callback(EVALUATOR_FAILED, evaluation->spawn_error,
+                         evaluation->user_data);
+    evaluation->spawn_error = NULL;
+    evaluation_free(evaluation);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void process_cb(GObject *source_object, GAsyncResult *res,
+                       gpointer user_data) {
+    GError *error = NULL;
+    GSubprocess *process = (GSubprocess *)source_object;
+    Evaluation *evaluation = (Evaluation *)user_data;
+    GBytes *stdout_bytes = NULL;
+
+    g_subprocess_communicate_finish(process, res, &stdout_bytes, NULL, &error);
+
+    if (evaluation->timeout_source != 0) {
+        g_source_remove(evaluation->timeout_source);
+    }
+
+    EvaluatorStatus status;
+    char *result;
+    if (evaluation->timed_out) {
+        status = EVALUATOR_TIMED_OUT;
+        result = g_strdup_printf(EVALUATOR_TIMED_OUT_MESSAGE,
+                                 evaluation->timeout);
+    } else if (error != NULL) {
+        // Usually writing batched inputs to a qalc that already died, for
+        // instance under its memory limit. It may not have exited yet, so
+        // its status can't be checked.
+        g_subprocess_force_exit(process);
+        status = EVALUATOR_ABORTED;
+        result = g_strdup_printf(COMMUNICATE_MESSAGE, error->message);
+    } else if (g_subprocess_get_if_signaled(process)) {
+        status = EVALUATOR_ABORTED;
+        result = g_strdup(EVALUATOR_ABORTED_MESSAGE);
+    } else if (g_subprocess_get_exit_status(process) > 1) {
+        // With qalculate >= 5.0.0, exit status 1 can mean bad (or
+        // incomplete) input, anything above is a broken qalc.
+        status = EVALUATOR_FAILED;
+        result = g_strdup_printf(EXIT_STATUS_MESSAGE, evaluation->qalc_binary,
+                                 g_subprocess_get_exit_status(process));
+    } else {
+        gsize length = 0;
+        const char *output = g_bytes_get_data(stdout_bytes, &length);
+
+        // Drop the trailing newline qalc always prints.
+        status = EVALUATOR_DONE;
+        result = g_strndup(output, length > 0 ? length - 1 : 0);
+    }
+
+    if (stdout_bytes != NULL) {
+        g_bytes_unref(stdout_bytes);
+    }
+    if (error != NULL) {
+        g_error_free(error);
+    }
+
+    evaluation->callback(status, result, evaluation->user_data);
+    evaluation_free(evaluation);
+    g_object_unref(process);
+}
+
+guint evaluator_timeout(const EvaluatorOptions *options) {
+    if (options->quick && (options->timeout == 0 ||
+                           options->timeout > EVALUATOR_QUICK_TIMEOUT)) {
+        return EVALUATOR_QUICK_TIMEOUT;
+    }
+    return options->timeout;
+}
+
+GPtrArray *evaluator_argv(const EvaluatorOptions *options) {
+    GPtrArray *argv = g_ptr_array_new_with_free_func(g_free);
+    g_ptr_array_add(argv, g_strdup(options->qalc_binary));
+    g_ptr_array_add(argv, g_strdup("-s"));
+    g_ptr_array_add(argv, g_strdup("update_exchange_rates 1days"));
+    if (options->terse) {
+        g_ptr_array_add(argv, g_strdup("-t"));
+    }
+    if (!options->no_unicode) {
+        g_ptr_array_add(argv, g_strdup("+u8"));
+    }
+    if (options->quick) {
+        g_ptr_array_add(argv, g_strdup("-s"));
+        g_ptr_array_add(argv, g_strdup("approximation approximate"));
+        g_ptr_array_add(argv, g_strdup("-s"));
+        g_ptr_array_add(argv, g_strdup_printf("precision %d",
+                                              EVALUATOR_QUICK_PRECISION));
+    }
+    return argv;
+}
+
+void evaluator_run(const EvaluatorOptions *options, const char *const *inputs,
+                   EvaluatorCallback callback, gpointer user_data) {
+    GError *error = NULL;
+
+    // Build array of strings that is later fed into a subprocess to actually
+    // start qalc with proper parameters.
+    GPtrArray *argv = evaluator_argv(options);
+    // A single input goes on the command line. Several are read from stdin
+    // by the same qalc process.
+    GBytes *stdin_bytes = NULL;
+    if (inputs[0] != NULL && inputs[1] == NULL) {
+        g_ptr_array_add(argv, g_strdup(inputs[0]));
+    } else {
+        GString *lines = g_string_new("");
+        for (const char *const *input = inputs; *input != NULL; input++) {
+            g_string_append(lines, *input);
+            g_string_append_c(lines, '\n');
+        }
+        gsize length = lines->len;
+        stdin_bytes = g_bytes_new_take(g_string_free(lines, FALSE), length);
+    }
+    g_ptr_array_add(argv, NULL);
+
+    Evaluation *evaluation = g_new0(Evaluation, 1);
+    evaluation->callback = callback;
+    evaluation->user_data = user_data;
+    evaluation->qalc_binary = g_strdup(options->qalc_binary);
+    evaluation->timeout = evaluator_timeout(options);
+    // The hard CPU limit is one second above the soft one, so qalc gets
+    // SIGXCPU before the kernel falls back to SIGKILL.
+    evaluation->cpu_limit.rlim_cur = options->cpu_limit;
+    evaluation->cpu_limit.rlim_max = options->cpu_limit + 1;
+    evaluation->memory_limit.rlim_cur = (rlim_t)options->memory_limit << 20;
+    evaluation->memory_limit.rlim_max = evaluation->memory_limit.rlim_cur;
+
+    GSubprocessLauncher *launcher = g_subprocess_launcher_new(
+        G_SUBPROCESS_FLAGS_STDOUT_PIPE | G_SUBPROCESS_FLAGS_STDERR_MERGE |
+        (stdin_bytes != NULL ? G_SUBPROCESS_FLAGS_STDIN_PIPE
+                             : G_SUBPROCESS_FLAGS_NONE));
+    g_subprocess_launcher_set_child_setup(launcher, apply_limits, evaluation,
+                                          NULL);
+    evaluation->process = g_subprocess_launcher_spawnv(
+        launcher, (const gchar **)(argv->pdata), &error);
+    g_object_unref(launcher);
+    g_ptr_array_free(argv, TRUE);
+
+    if (error != NULL) {
+        evaluation->spawn_error = g_strdup_printf(
+            SPAWN_FAILED_MESSAGE, options->qalc_binary, error->message);
+        g_error_free(error);
+        g_idle_add(spawn_failed_cb, evaluation);
+        if (stdin_bytes != NULL) {
+            g_bytes_unref(stdin_bytes);
+        }
+        return;
+    }
+
+    if (evaluation->timeout > 0) {
+        evaluation->timeout_source =
+            g_timeout_add(evaluation->timeout, timeout_cb, evaluation);
+    }
+
+    g_subprocess_communicate_async(evaluation->process, stdin_bytes, NULL,
+                                   process_cb, (gpointer)evaluation);
+    if (stdin_bytes != NULL) {
+        g_bytes_unref(stdin_bytes);
+    }
+}
@@ -0,0 +1,93 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef ROFI_CALC_EVALUATOR_H
+#define ROFI_CALC_EVALUATOR_H
+
+#include <glib.h>
+
+// Default wall-clock deadline for a single evaluation in milliseconds.
+#define EVALUATOR_DEFAULT_TIMEOUT 5000
+
+// Quick evaluations give up after this many milliseconds and compute with
+// this many significant digits. Starting qalc alone takes a few hundred
+// milliseconds, a shorter deadline would rarely leave time for a result.
+#define EVALUATOR_QUICK_TIMEOUT 1000
+#define EVALUATOR_QUICK_PRECISION 8
+
+// Shown instead of a result when qalc was killed. These start with `error:`
+// so they are treated like qalc's own errors.
+#define EVALUATOR_TIMED_OUT_MESSAGE "error: evaluation timed out after %u ms"
+#define EVALUATOR_ABORTED_MESSAGE                                             \
+    "error: evaluation aborted, resource limit reached"
+
+// How qalc gets started for an evaluation.
+typedef struct {
+    const char *qalc_binary;
+    gboolean terse;
+    gboolean no_unicode;
+    // Trade accuracy for speed: approximate, low precision and a short
+    // deadline. Used for preliminary results.
+    gboolean quick;
+    // Wall-clock deadline in milliseconds, 0 to wait forever.
+    guint timeout;
+    // CPU time limit in seconds, 0 for none.
+    guint cpu_limit;
+    // Address space limit in MiB, 0 for none.
+    guint memory_limit;
+} EvaluatorOptions;
+
+// How an evaluation ended.
+typedef enum {
+    // qalc exited on its own, `result` is its output.
+    EVALUATOR_DONE,
+    // qalc was killed because it ran past its deadline.
+    EVALUATOR_TIMED_OUT,
+    // qalc was killed by a signal or stopped talking to us, usually for
+    // exceeding a resource limit.
+    EVALUATOR_ABORTED,
+    // qalc couldn't be started or exited with an unexpected status.
+    EVALUATOR_FAILED,
+} EvaluatorStatus;
+
+// Called once an evaluation finished. For evaluations that didn't finish on
+// their own, `result` is an error message. The callee owns `result`.
+typedef void (*EvaluatorCallback)(EvaluatorStatus status, char *result,
+                                  gpointer user_data);
+
+// The deadline in milliseconds that applies to an evaluation with `options`.
+guint evaluator_timeout(const EvaluatorOptions *options);
+
+// Build qalc's command line for `options`, without inputs and without the
+// terminating NULL. The array owns its strings.
+GPtrArray *evaluator_argv(const EvaluatorOptions *options);
+
+// Start evaluating the NULL-terminated `inputs` with qalc in the background.
+// Several inputs are fed to a single qalc process, one per line, and its
+// output holds one result per line. `callback` is invoked from the main
+// loop when qalc exits.
+void evaluator_run(const EvaluatorOptions *options, const char *const *inputs,
+                   EvaluatorCallback callback, gpointer user_data);
+
+#endif
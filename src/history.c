@@ -0,0 +1,303 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "history.h"
+
+#include <string.h>
+
+#include "protocol.h"
+
+// Used in splitting equations into {expression} and {result}.
+#define PARENS_LEFT '('
+#define PARENS_RIGHT ')'
+#define EQUALS_SIGN '='
+#define APPROX_SIGN "≈"
+
+// First line of a history file holding serialized records. Files without it
+// are plain-text histories with one `expression = result` per line.
+#define HISTORY_HEADER "# rofi-calc history v2"
+
+// Markers for the approximate field of a serialized record.
+#define RECORD_EXACT "="
+#define RECORD_APPROXIMATE "~"
+
+// Split the equation result into the left (expression) and right (result)
+// side of the equals sign.
+//
+// Note that both sides can themselves contain equals sign, consider the
+// simple example of `20x + 40 = 100`. This means we cannot naively split on
+// the '=' character. Instead we track our level of nestedness while walking
+// forward once and remember the last equals sign outside of parentheses.
+HistoryRecord *history_record_new(const char *output, gboolean terse,
+                                  const char *flags) {
+    HistoryRecord *record = g_new0(HistoryRecord, 1);
+    record->timestamp = g_get_real_time() / G_USEC_PER_SEC;
+    record->flags = g_strdup(flags);
+
+    if (terse) {
+        // With -terse, output _is_ the result.
+        record->result = g_strdup(output);
+        return record;
+    }
+
+    const size_t approx_len = strlen(APPROX_SIGN);
+    const char *delimiter = NULL;
+    size_t delimiter_len = 0;
+    int parens_depth = 0;
+
+    for (const char *curr = output; *curr; curr++) {
+        if (*curr == PARENS_LEFT) {
+            parens_depth++;
+        } else if (*curr == PARENS_RIGHT) {
+            parens_depth--;
+        } else if (parens_depth == 0) {
+            if (*curr == EQUALS_SIGN) {
+                delimiter = curr;
+                delimiter_len = 1;
+                record->approximate = FALSE;
+            } else if (*curr == APPROX_SIGN[0] &&
+                       !strncmp(curr, APPROX_SIGN, approx_len)) {
+                delimiter = curr;
+                delimiter_len = approx_len;
+                record->approximate = TRUE;
+                curr += approx_len - 1;
+            }
+        }
+    }
+
+    if (delimiter == NULL || delimiter == output) {
+        // No equals signs were found. Shouldn't happen, but if it does
+        // treat the entire expression as the result.
+        record->approximate = FALSE;
+        record->result = g_strdup(output);
+    } else {
+        // Strip trailing whitespace with `g_strchomp()` from the left.
+        // Strip leading whitespace with `g_strchug()` from the right.
+        record->expression =
+            g_strchomp(g_strndup(output, delimiter - output));
+        record->result = g_strchug(g_strdup(delimiter + delimiter_len));
+    }
+
+    return record;
+}
+
+HistoryRecord *history_record_copy(const HistoryRecord *record) {
+    HistoryRecord *copy = g_new0(HistoryRecord, 1);
+    copy->expression = g_strdup(record->expression);
+    copy->result = g_strdup(record->result);
+    copy->approximate = record->approximate;
+    copy->timestamp = record->timestamp;
+    copy->flags = g_strdup(record->flags);
+    return copy;
+}
+
+gboolean history_record_equal(const HistoryRecord *a, const HistoryRecord *b) {
+    return a->timestamp == b->timestamp && a->approximate == b->approximate &&
+           g_strcmp0(a->expression, b->expression) == 0 &&
+           g_strcmp0(a->result, b->result) == 0 &&
+           g_strcmp0(a->flags, b->flags) == 0;
+}
+
+void history_record_free(gpointer data) {
+    HistoryRecord *record = (HistoryRecord *)data;
+    if (record == NULL) {
+        return;
+    }
+    g_free(record->expression);
+    g_free(record->result);
+    g_free(record->flags);
+    g_free(record);
+}
+
+gchar *history_record_format(const HistoryRecord *record) {
+    if (record->expression == NULL) {
+        return g_strdup(record->result);
+    }
+    return g_strdup_printf("%s %s %s", record->expression,
+                           record->approximate ? APPROX_SIGN : "=",
+                           record->result);
+}
+
+gchar *history_record_to_string(const HistoryRecord *record) {
+    // Replace newlines with semicolons so one entry isn't split into
+    // multiple entries
+    return g_strdelimit(history_record_format(record), "\n", ';');
+}
+
+gchar *history_record_serialize(const HistoryRecord *record) {
+    gchar *timestamp = g_strdup_printf("%" G_GINT64_FORMAT, record->timestamp);
+    const gchar *fields[] = {
+        timestamp,
+        record->flags != NULL ? record->flags : "",
+        record->approximate ? RECORD_APPROXIMATE : RECORD_EXACT,
+        record->expression != NULL ? record->expression : "",
+        record->result,
+        NULL,
+    };
+
+    gchar *line = protocol_join(fields);
+    g_free(timestamp);
+
+    // Drop the newline `protocol_join` ends every line with.
+    line[strlen(line) - 1] = '\0';
+    return line;
+}
+
+HistoryRecord *history_record_deserialize(const char *line) {
+    gchar **fields = protocol_split(line);
+
+    if (g_strv_length(fields) != 5) {
+        g_strfreev(fields);
+        return NULL;
+    }
+
+    HistoryRecord *record = g_new0(HistoryRecord, 1);
+    record->timestamp = g_ascii_strtoll(fields[0], NULL, 10);
+    record->flags = g_strdup(fields[1]);
+    record->approximate = strcmp(fields[2], RECORD_APPROXIMATE) == 0;
+    record->expression = *fields[3] ? g_strdup(fields[3]) : NULL;
+    record->result = g_strdup(fields[4]);
+
+    g_strfreev(fields);
+    return record;
+}
+
+// Write all of `history` to the history file.
+static void save_history(GPtrArray *history) {
+    GError *error = NULL;
+    gchar *history_dir = g_build_filename(g_get_user_data_dir(), "rofi", NULL);
+    gchar *history_file =
+        g_build_filename(history_dir, "rofi_calc_history", NULL);
+    GString *contents = g_string_new(HISTORY_HEADER "\n");
+
+    g_mkdir_with_parents(history_dir, 0755);
+
+    for (guint i = 0; i < history->len; i++) {
+        gchar *line = history_record_serialize(g_ptr_array_index(history, i));
+        g_string_append(contents, line);
+        g_string_append_c(contents, '\n');
+        g_free(line);
+    }
+
+    g_file_set_contents(history_file, contents->str, contents->len, &error);
+
+    if (error != NULL) {
+        g_error("Error while writing the history file: %s", error->message);
+        g_error_free(error);
+    }
+
+    g_string_free(contents, TRUE);
+    g_free(history_file);
+    g_free(history_dir);
+}
+
+// Append `record` to history.
+void append_record_to_history(const HistoryRecord *record) {
+    GPtrArray *history = g_ptr_array_new_with_free_func(history_record_free);
+    load_history(history);
+
+    g_ptr_array_add(history, history_record_copy(record));
+    if (history->len > HISTORY_LENGTH) {
+        g_ptr_array_remove_range(history, 0, history->len - HISTORY_LENGTH);
+    }
+
+    save_history(history);
+    g_ptr_array_unref(history);
+}
+
+gboolean remove_record_from(GPtrArray *history, const HistoryRecord *record) {
+    for (guint i = history->len; i > 0; i--) {
+        if (history_record_equal(g_ptr_array_index(history, i - 1), record)) {
+            g_ptr_array_remove_index(history, i - 1);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Delete `record` from history. Matching by content rather than position
+// keeps this correct when another rofi instance changed the file meanwhile.
+void delete_record_from_history(const HistoryRecord *record) {
+    GPtrArray *history = g_ptr_array_new_with_free_func(history_record_free);
+    load_history(history);
+
+    if (remove_record_from(history, record)) {
+        save_history(history);
+    }
+
+    g_ptr_array_unref(history);
+}
+
+// Load old history if it exists.
+void load_history(GPtrArray *history) {
+    GError *error = NULL;
+    gchar *history_file = g_build_filename(g_get_user_data_dir(), "rofi",
+                                           "rofi_calc_history", NULL);
+    gchar *history_contents;
+
+    if (g_file_test(history_file,
+                    G_FILE_TEST_EXISTS | G_FILE_TEST_IS_REGULAR)) {
+        g_file_get_contents(history_file, &history_contents, NULL, &error);
+
+        if (error != NULL) {
+            g_error("Error while reading the history file: %s",
+                    error->message);
+            g_error_free(error);
+        }
+
+        gchar **lines = g_strsplit(history_contents, "\n", -1);
+        gboolean is_legacy = strcmp(lines[0], HISTORY_HEADER) != 0;
+
+        for (gchar **line = is_legacy ? lines : lines + 1; *line != NULL;
+             line++) {
+            if (**line == '\0') {
+                continue;
+            }
+
+            HistoryRecord *record;
+            if (is_legacy) {
+                record = history_record_new(*line, FALSE, "");
+                record->timestamp = 0;
+            } else {
+                record = history_record_deserialize(*line);
+            }
+
+            if (record != NULL) {
+                g_ptr_array_add(history, record);
+            } else {
+                g_warning("Skipping malformed history entry: %s", *line);
+            }
+        }
+
+        g_strfreev(lines);
+        g_free(history_contents);
+
+        // Rewrite plain-text histories as records so this only happens once.
+        if (is_legacy) {
+            save_history(history);
+        }
+    }
+
+    g_free(history_file);
+}
@@ -0,0 +1,87 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef ROFI_CALC_HISTORY_H
+#define ROFI_CALC_HISTORY_H
+
+#include <glib.h>
+
+// Maximum number of entries kept in the history file.
+#define HISTORY_LENGTH 100
+
+// One evaluated equation as kept in history.
+typedef struct {
+    // Left-hand side of the equation, NULL when qalc only printed a result
+    // (for instance with `-terse`).
+    char *expression;
+    // Right-hand side of the equation.
+    char *result;
+    // Whether qalc printed `≈` instead of `=`.
+    gboolean approximate;
+    // Seconds since the epoch, 0 for entries migrated from old histories.
+    gint64 timestamp;
+    // Evaluator flags the result was produced with, see
+    // `protocol_format_flags`.
+    char *flags;
+} HistoryRecord;
+
+// Build a record from qalc's output in a single forward pass.
+HistoryRecord *history_record_new(const char *output, gboolean terse,
+                                  const char *flags);
+
+HistoryRecord *history_record_copy(const HistoryRecord *record);
+
+// Whether `a` and `b` are the same record, field by field.
+gboolean history_record_equal(const HistoryRecord *a, const HistoryRecord *b);
+
+void history_record_free(gpointer record);
+
+// Format `record` the way qalc printed it.
+gchar *history_record_format(const HistoryRecord *record);
+
+// Format `record` the way qalc printed it, on a single line.
+gchar *history_record_to_string(const HistoryRecord *record);
+
+// Serialize `record` into a single line without trailing newline.
+gchar *history_record_serialize(const HistoryRecord *record);
+
+// Parse a line produced by `history_record_serialize`. Returns NULL if the
+// line is malformed.
+HistoryRecord *history_record_deserialize(const char *line);
+
+// Append `record` to the history file.
+void append_record_to_history(const HistoryRecord *record);
+
+// Remove the most recent record equal to `record` from `history`. Returns
+// FALSE if there is none.
+gboolean remove_record_from(GPtrArray *history, const HistoryRecord *record);
+
+// Delete the most recent record equal to `record` from the history file.
+void delete_record_from_history(const HistoryRecord *record);
+
+// Load the history file into `history` as `HistoryRecord`s, oldest entry
+// first. Old plain-text history files are migrated on the fly.
+void load_history(GPtrArray *history);
+
+#endif
@@ -0,0 +1,145 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "protocol.h"
+
+#include <string.h>
+
+// Flags for `EvaluatorOptions`.
+#define FLAG_TERSE 't'
+#define FLAG_UNICODE 'u'
+#define FLAG_QUICK 'q'
+
+gchar *protocol_socket_path(void) {
+    return g_build_filename(g_get_user_runtime_dir(), PROTOCOL_SOCKET_NAME,
+                            NULL);
+}
+
+gchar *protocol_join(const gchar *const *fields) {
+    GString *line = g_string_new("");
+
+    for (const gchar *const *field = fields; *field != NULL; field++) {
+        if (field != fields) {
+            g_string_append_c(line, '\t');
+        }
+
+        for (const gchar *c = *field; *c; c++) {
+            switch (*c) {
+            case '\\':
+                g_string_append(line, "\\\\");
+                break;
+            case '\t':
+                g_string_append(line, "\\t");
+                break;
+            case '\n':
+                g_string_append(line, "\\n");
+                break;
+            default:
+                g_string_append_c(line, *c);
+            }
+        }
+    }
+
+    g_string_append_c(line, '\n');
+    return g_string_free(line, FALSE);
+}
+
+gchar **protocol_split(const gchar *line) {
+    GPtrArray *fields = g_ptr_array_new();
+    GString *field = g_string_new("");
+
+    for (const gchar *c = line;; c++) {
+        if (*c == '\0' || *c == '\t') {
+            g_ptr_array_add(fields, g_string_free(field, FALSE));
+            if (*c == '\0') {
+                break;
+            }
+            field = g_string_new("");
+        } else if (*c == '\\' && c[1] != '\0') {
+            c++;
+            g_string_append_c(field, *c == 't' ? '\t' : *c == 'n' ? '\n' : *c);
+        } else {
+            g_string_append_c(field, *c);
+        }
+    }
+
+    g_ptr_array_add(fields, NULL);
+    return (gchar **)g_ptr_array_free(fields, FALSE);
+}
+
+gchar *protocol_format_flags(const EvaluatorOptions *options) {
+    GString *flags = g_string_new("");
+    if (options->terse) {
+        g_string_append_c(flags, FLAG_TERSE);
+    }
+    if (!options->no_unicode) {
+        g_string_append_c(flags, FLAG_UNICODE);
+    }
+    if (options->quick) {
+        g_string_append_c(flags, FLAG_QUICK);
+    }
+    return g_string_free(flags, FALSE);
+}
+
+void protocol_parse_flags(const gchar *flags, EvaluatorOptions *options) {
+    options->terse = strchr(flags, FLAG_TERSE) != NULL;
+    options->no_unicode = strchr(flags, FLAG_UNICODE) == NULL;
+    options->quick = strchr(flags, FLAG_QUICK) != NULL;
+}
+
+gchar *protocol_format_limits(const EvaluatorOptions *options) {
+    return g_strdup_printf("%u:%u:%u", options->timeout, options->cpu_limit,
+                           options->memory_limit);
+}
+
+gboolean protocol_parse_limits(const gchar *limits,
+                               EvaluatorOptions *options) {
+    gchar **values = g_strsplit(limits, ":", -1);
+    gboolean valid = g_strv_length(values) == 3;
+
+    for (guint i = 0; valid && i < 3; i++) {
+        valid = *values[i] != '\0' &&
+                strspn(values[i], "0123456789") == strlen(values[i]);
+    }
+    if (valid) {
+        options->timeout = g_ascii_strtoull(values[0], NULL, 10);
+        options->cpu_limit = g_ascii_strtoull(values[1], NULL, 10);
+        options->memory_limit = g_ascii_strtoull(values[2], NULL, 10);
+    }
+
+    g_strfreev(values);
+    return valid;
+}
+
+gchar *protocol_format_status(EvaluatorStatus status) {
+    return g_strdup_printf("%d", status);
+}
+
+EvaluatorStatus protocol_parse_status(const gchar *status) {
+    gint64 value = g_ascii_strtoll(status, NULL, 10);
+    if (value < EVALUATOR_DONE || value > EVALUATOR_FAILED) {
+        return EVALUATOR_ABORTED;
+    }
+    return (EvaluatorStatus)value;
+}
@@ -0,0 +1,85 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef ROFI_CALC_PROTOCOL_H
+#define ROFI_CALC_PROTOCOL_H
+
+#include <glib.h>
+
+#include "evaluator.h"
+
+// Wire protocol between the plugin and `rofi-calcd`.
+//
+// Every request and reply is a single line of tab-separated fields. Tabs,
+// newlines and backslashes inside a field are backslash-escaped. Replies
+// start with either `OK` or `ERR`, followed by the reply fields or an error
+// message.
+//
+//     EVAL <flags> <limits> <qalc-binary> <input>...
+//                                -> OK <status> <result>
+//     HISTORY                    -> OK <record>...
+//     HISTORY_ADD <record>       -> OK
+//     HISTORY_DELETE <record>    -> OK
+//
+// History records are passed as serialized by `history_record_serialize`.
+
+#define PROTOCOL_EVAL "EVAL"
+#define PROTOCOL_HISTORY "HISTORY"
+#define PROTOCOL_HISTORY_ADD "HISTORY_ADD"
+#define PROTOCOL_HISTORY_DELETE "HISTORY_DELETE"
+#define PROTOCOL_OK "OK"
+#define PROTOCOL_ERR "ERR"
+
+// Name of the daemon socket inside `$XDG_RUNTIME_DIR`.
+#define PROTOCOL_SOCKET_NAME "rofi-calc.sock"
+
+// Default path of the daemon socket. Returns a new string.
+gchar *protocol_socket_path(void);
+
+// Join NULL-terminated `fields` into one newline-terminated line.
+gchar *protocol_join(const gchar *const *fields);
+
+// Split a line (without its newline) back into its unescaped fields.
+gchar **protocol_split(const gchar *line);
+
+// Encode the evaluator options that affect qalc's output as flags.
+gchar *protocol_format_flags(const EvaluatorOptions *options);
+
+// Decode flags produced by `protocol_format_flags` into `options`.
+void protocol_parse_flags(const gchar *flags, EvaluatorOptions *options);
+
+// Encode the timeout and resource limits of `options`.
+gchar *protocol_format_limits(const EvaluatorOptions *options);
+
+// Decode limits produced by `protocol_format_limits` into `options`.
+// Returns FALSE if `limits` is malformed.
+gboolean protocol_parse_limits(const gchar *limits, EvaluatorOptions *options);
+
+// Encode how an evaluation ended.
+gchar *protocol_format_status(EvaluatorStatus status);
+
+// Decode a status produced by `protocol_format_status`.
+EvaluatorStatus protocol_parse_status(const gchar *status);
+
+#endif
@@ -0,0 +1,567 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+// rofi-calc-replay: re-drive the plugin with a trace recorded by
+// `-calc-trace`.
+//
+// The built `calc` module is loaded the way rofi loads it and its `Mode`
+// callbacks are called with the inputs and actions of the trace, at their
+// original times. This tool stands in for rofi and provides the few rofi
+// functions the plugin uses. The replay is traced as well, and the
+// input-to-result latencies of both traces are printed side by side.
+//
+// Evaluations use the real evaluator, or with `--stub` this binary again,
+// acting as qalc. It then answers each evaluation with the result and
+// latency recorded in the trace, which takes qalc out of the measurement.
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <gmodule.h>
+#include <rofi/helper.h>
+#include <rofi/mode-private.h>
+#include <rofi/mode.h>
+#include <rofi/rofi-types.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "evaluator.h"
+#include "protocol.h"
+#include "trace.h"
+
+// Set to the trace path when this binary runs as the stub qalc.
+#define STUB_ENV "ROFI_CALC_REPLAY_STUB"
+
+// How long to wait for outstanding evaluations after the last event.
+#define DEFAULT_SETTLE 1000
+
+// The build passes the path of the calc module it builds next to this.
+#ifndef CALC_MODULE
+#define CALC_MODULE "libcalc.so"
+#endif
+
+typedef struct {
+    Mode *mode;
+    GPtrArray *events;
+    guint next_event;
+    gint64 started;
+    gdouble speed;
+    guint settle;
+    guint settle_source;
+    guint refresh_source;
+    gboolean destroyed;
+    GMainLoop *loop;
+} Replay;
+
+// rofi's functions don't take a context, so there is only one replay.
+static Replay replay;
+
+// Options the plugin sees as rofi's command line.
+static GPtrArray *plugin_args;
+
+// Functions the plugin expects from rofi.
+
+void *mode_get_private_data(const Mode *mode) { return mode->private_data; }
+
+void mode_set_private_data(Mode *mode, void *pd) { mode->private_data = pd; }
+
+int find_arg(const char *const key) {
+    for (guint i = 0; i < plugin_args->len; i++) {
+        if (strcmp(g_ptr_array_index(plugin_args, i), key) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int find_arg_str(const char *const key, char **val) {
+    int i = find_arg(key);
+    if (i < 0 || (guint)i + 1 >= plugin_args->len) {
+        return FALSE;
+    }
+    *val = g_ptr_array_index(plugin_args, i + 1);
+    return TRUE;
+}
+
+int find_arg_uint(const char *const key, unsigned int *val) {
+    char *str = NULL;
+    if (!find_arg_str(key, &str)) {
+        return FALSE;
+    }
+    *val = strtoul(str, NULL, 10);
+    return TRUE;
+}
+
+// The replay has no config file, plugin options come from the command line.
+ConfigEntry *rofi_config_find_widget(G_GNUC_UNUSED const char *name,
+                                     G_GNUC_UNUSED const char *state,
+                                     G_GNUC_UNUSED gboolean exact) {
+    return NULL;
+}
+
+Property *rofi_theme_find_property(G_GNUC_UNUSED ConfigEntry *widget,
+                                   G_GNUC_UNUSED PropertyType type,
+                                   G_GNUC_UNUSED const char *property,
+                                   G_GNUC_UNUSED gboolean exact) {
+    return NULL;
+}
+
+char *helper_string_replace_if_exists(char *string, ...) {
+    gchar *result = g_strdup(string);
+    va_list ap;
+
+    va_start(ap, string);
+    for (const char *key = va_arg(ap, const char *); key != NULL;
+         key = va_arg(ap, const char *)) {
+        const char *value = va_arg(ap, const char *);
+        gchar **parts = g_strsplit(result, key, -1);
+        g_free(result);
+        result = g_strjoinv(value != NULL ? value : "", parts);
+        g_strfreev(parts);
+    }
+    va_end(ap);
+
+    return result;
+}
+
+// Never run `-calc-command` during a replay.
+gboolean
+helper_execute_command(G_GNUC_UNUSED const char *wd, const char *cmd,
+                       G_GNUC_UNUSED gboolean run_in_term,
+                       G_GNUC_UNUSED RofiHelperExecuteContext *context) {
+    g_message("Not running: %s", cmd);
+    return TRUE;
+}
+
+static gboolean settle_cb(gpointer user_data);
+
+// Do what rofi does after a change: fetch the message and the rows.
+static gboolean refresh_cb(G_GNUC_UNUSED gpointer user_data) {
+    replay.refresh_source = 0;
+
+    if (replay.destroyed) {
+        return G_SOURCE_REMOVE;
+    }
+
+    g_free(replay.mode->_get_message(replay.mode));
+    unsigned int rows = replay.mode->_get_num_entries(replay.mode);
+    for (unsigned int i = 0; i < rows; i++) {
+        int state = 0;
+        GList *attributes = NULL;
+        g_free(replay.mode->_get_display_value(replay.mode, i, &state,
+                                               &attributes, TRUE));
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+void rofi_view_reload(void) {
+    if (replay.refresh_source == 0) {
+        replay.refresh_source = g_idle_add(refresh_cb, NULL);
+    }
+
+    // Results are still coming in, keep waiting.
+    if (replay.settle_source != 0) {
+        g_source_remove(replay.settle_source);
+        replay.settle_source =
+            g_timeout_add(replay.settle, settle_cb, NULL);
+    }
+}
+
+// Replay driver.
+
+static void finish(void) {
+    if (!replay.destroyed) {
+        replay.mode->_destroy(replay.mode);
+        replay.destroyed = TRUE;
+    }
+    g_main_loop_quit(replay.loop);
+}
+
+static gboolean settle_cb(G_GNUC_UNUSED gpointer user_data) {
+    replay.settle_source = 0;
+    finish();
+    return G_SOURCE_REMOVE;
+}
+
+static void schedule_next_event(void);
+
+static gboolean event_cb(G_GNUC_UNUSED gpointer user_data) {
+    TraceEvent *event = g_ptr_array_index(replay.events, replay.next_event);
+    const char *name = event->fields[0];
+    guint length = g_strv_length(event->fields);
+
+    replay.next_event++;
+
+    if (strcmp(name, TRACE_INPUT) == 0 && length == 2) {
+        g_free(replay.mode->_preprocess_input(replay.mode, event->fields[1]));
+        rofi_view_reload();
+    } else if (strcmp(name, TRACE_RESULT) == 0 && length == 4) {
+        int menu_entry = atoi(event->fields[1]);
+        unsigned int selected_line = strtoul(event->fields[2], NULL, 10);
+
+        // The replay starts without history, so rows picked during the
+        // recording may not exist. rofi never passes those.
+        if (selected_line >= replay.mode->_get_num_entries(replay.mode)) {
+            g_message("Skipping action on row %u, it doesn't exist in the "
+                      "replay",
+                      selected_line);
+            schedule_next_event();
+            return G_SOURCE_REMOVE;
+        }
+
+        char *input = g_strdup(event->fields[3]);
+        ModeMode mode_mode = replay.mode->_result(replay.mode, menu_entry,
+                                                  &input, selected_line);
+        g_free(input);
+
+        // rofi would close here.
+        if (mode_mode == MODE_EXIT) {
+            finish();
+            return G_SOURCE_REMOVE;
+        }
+        rofi_view_reload();
+    }
+    // Evaluations are what's being measured, they aren't replayed.
+
+    schedule_next_event();
+    return G_SOURCE_REMOVE;
+}
+
+static void schedule_next_event(void) {
+    if (replay.next_event >= replay.events->len) {
+        replay.settle_source = g_timeout_add(replay.settle, settle_cb, NULL);
+        return;
+    }
+
+    TraceEvent *event = g_ptr_array_index(replay.events, replay.next_event);
+    gint64 due = replay.started + (gint64)(event->time / replay.speed);
+    gint64 delay = MAX(due - g_get_monotonic_time(), 0);
+    g_timeout_add(delay / 1000, event_cb, NULL);
+}
+
+// Reporting.
+
+static int compare_latency(gconstpointer a, gconstpointer b) {
+    gint64 left = *(const gint64 *)a;
+    gint64 right = *(const gint64 *)b;
+    return (left > right) - (left < right);
+}
+
+// Print statistics of `events`. The latency of an input is the time until
+// the first full evaluation of it finished. Inputs the plugin never
+// evaluated, for instance because they were debounced, are skipped.
+static void print_summary(const char *label, GPtrArray *events) {
+    GArray *latencies = g_array_new(FALSE, FALSE, sizeof(gint64));
+    guint inputs = 0;
+    guint evaluations = 0;
+    gint64 evaluation_time = 0;
+    const char *previous_input = "";
+
+    for (guint i = 0; i < events->len; i++) {
+        TraceEvent *event = g_ptr_array_index(events, i);
+
+        if (strcmp(event->fields[0], TRACE_EVALUATION) == 0 &&
+            g_strv_length(event->fields) >= 6) {
+            evaluations++;
+            evaluation_time += g_ascii_strtoll(event->fields[3], NULL, 10);
+            continue;
+        }
+
+        // The plugin ignores repeated inputs.
+        if (strcmp(event->fields[0], TRACE_INPUT) != 0 ||
+            g_strv_length(event->fields) != 2 ||
+            strcmp(event->fields[1], previous_input) == 0) {
+            continue;
+        }
+        previous_input = event->fields[1];
+        if (*event->fields[1] == '\0') {
+            continue;
+        }
+        inputs++;
+
+        for (guint j = i + 1; j < events->len; j++) {
+            TraceEvent *done = g_ptr_array_index(events, j);
+            if (strcmp(done->fields[0], TRACE_EVALUATION) == 0 &&
+                g_strv_length(done->fields) == 6 &&
+                strcmp(done->fields[1], "full") == 0 &&
+                strcmp(done->fields[5], event->fields[1]) == 0) {
+                gint64 latency = done->time - event->time;
+                g_array_append_val(latencies, latency);
+                break;
+            }
+        }
+    }
+
+    g_array_sort(latencies, compare_latency);
+
+    printf("%s: %u inputs, %u evaluations", label, inputs, evaluations);
+    if (evaluations > 0) {
+        printf(" taking %.1f ms on average",
+               evaluation_time / 1000.0 / evaluations);
+    }
+    printf("\n");
+
+    if (latencies->len > 0) {
+        gint64 total = 0;
+        for (guint i = 0; i < latencies->len; i++) {
+            total += g_array_index(latencies, gint64, i);
+        }
+        printf("    input to result (%u inputs): mean %.1f ms, median %.1f "
+               "ms, p95 %.1f ms, max %.1f ms\n",
+               latencies->len, total / 1000.0 / latencies->len,
+               g_array_index(latencies, gint64, latencies->len / 2) / 1000.0,
+               g_array_index(latencies, gint64,
+                             (latencies->len - 1) * 95 / 100) /
+                   1000.0,
+               g_array_index(latencies, gint64, latencies->len - 1) / 1000.0);
+    }
+
+    g_array_free(latencies, TRUE);
+}
+
+// Stub qalc.
+
+static gboolean inputs_equal(gchar **a, gchar **b) {
+    for (; *a != NULL && *b != NULL; a++, b++) {
+        if (strcmp(*a, *b) != 0) {
+            return FALSE;
+        }
+    }
+    return *a == NULL && *b == NULL;
+}
+
+// Answer like qalc would have during the recorded session. Inputs come from
+// stdin when batched, otherwise they're the last argument.
+static int run_stub(const char *trace_path, int argc, char **argv) {
+    GPtrArray *events = g_ptr_array_new_with_free_func(trace_event_free);
+    if (!trace_load(trace_path, events)) {
+        return EXIT_FAILURE;
+    }
+
+    gboolean quick = FALSE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "approximation approximate") == 0) {
+            quick = TRUE;
+        }
+    }
+
+    GString *stdin_contents = g_string_new("");
+    char buffer[4096];
+    size_t bytes_read;
+    while ((bytes_read = fread(buffer, 1, sizeof(buffer), stdin)) > 0) {
+        g_string_append_len(stdin_contents, buffer, bytes_read);
+    }
+
+    gchar **inputs;
+    if (stdin_contents->len > 0) {
+        // Drop the newline after the last input.
+        g_string_truncate(stdin_contents, stdin_contents->len - 1);
+        inputs = g_strsplit(stdin_contents->str, "\n", -1);
+    } else {
+        const gchar *single[] = {argv[argc - 1], NULL};
+        inputs = g_strdupv((gchar **)single);
+    }
+    g_string_free(stdin_contents, TRUE);
+
+    TraceEvent *match = NULL;
+    for (guint i = 0; i < events->len && match == NULL; i++) {
+        TraceEvent *event = g_ptr_array_index(events, i);
+        if (strcmp(event->fields[0], TRACE_EVALUATION) == 0 &&
+            g_strv_length(event->fields) >= 6 &&
+            (strcmp(event->fields[1], "quick") == 0) == quick &&
+            inputs_equal(event->fields + 5, inputs)) {
+            match = event;
+        }
+    }
+    g_strfreev(inputs);
+
+    if (match == NULL) {
+        printf("error: not in the trace\n");
+        g_ptr_array_free(events, TRUE);
+        return EXIT_SUCCESS;
+    }
+
+    EvaluatorStatus status = protocol_parse_status(match->fields[2]);
+    gint64 latency = g_ascii_strtoll(match->fields[3], NULL, 10);
+
+    // A timed out evaluation is killed by the plugin's deadline before it
+    // gets here, unless the replay runs with a longer one.
+    g_usleep(latency);
+    if (status == EVALUATOR_ABORTED) {
+        raise(SIGKILL);
+    }
+
+    printf("%s\n", match->fields[4]);
+    g_ptr_array_free(events, TRUE);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv) {
+    const char *stub_trace = g_getenv(STUB_ENV);
+    if (stub_trace != NULL) {
+        return run_stub(stub_trace, argc, argv);
+    }
+
+    GError *error = NULL;
+    gchar *module_path = NULL;
+    gchar *output_path = NULL;
+    gboolean stub = FALSE;
+    gdouble speed = 1.0;
+    gint settle = DEFAULT_SETTLE;
+
+    // Everything after `--` is passed to the plugin.
+    plugin_args = g_ptr_array_new();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            for (int j = i + 1; j < argc; j++) {
+                g_ptr_array_add(plugin_args, argv[j]);
+            }
+            argc = i;
+            break;
+        }
+    }
+
+    GOptionEntry entries[] = {
+        {"module", 0, 0, G_OPTION_ARG_FILENAME, &module_path,
+         "The calc module to load, defaults to the one built with this binary",
+         "PATH"},
+        {"stub", 0, 0, G_OPTION_ARG_NONE, &stub,
+         "Answer evaluations with the recorded results and latencies", NULL},
+        {"speed", 0, 0, G_OPTION_ARG_DOUBLE, &speed,
+         "Replay FACTOR times as fast as recorded", "FACTOR"},
+        {"settle", 0, 0, G_OPTION_ARG_INT, &settle,
+         "Wait MS for outstanding evaluations after the last event", "MS"},
+        {"output", 0, 0, G_OPTION_ARG_FILENAME, &output_path,
+         "Keep the trace of the replay at PATH", "PATH"},
+        {NULL, 0, 0, 0, NULL, NULL, NULL},
+    };
+
+    GOptionContext *context =
+        g_option_context_new("TRACE [-- PLUGIN-OPTIONS...] - replay a "
+                             "rofi-calc session");
+    g_option_context_add_main_entries(context, entries, NULL);
+    if (!g_option_context_parse(context, &argc, &argv, &error)) {
+        g_printerr("%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(context);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(context);
+
+    if (argc != 2 || speed <= 0) {
+        g_printerr("Usage: %s [OPTIONS] TRACE [-- PLUGIN-OPTIONS...]\n",
+                   g_get_prgname());
+        return EXIT_FAILURE;
+    }
+    const char *trace_path = argv[1];
+
+    GPtrArray *recorded = g_ptr_array_new_with_free_func(trace_event_free);
+    if (!trace_load(trace_path, recorded)) {
+        return EXIT_FAILURE;
+    }
+
+    if (module_path == NULL) {
+        module_path = g_strdup(CALC_MODULE);
+    }
+
+    gboolean keep_output = output_path != NULL;
+    if (!keep_output) {
+        int fd = g_file_open_tmp("rofi-calc-replay-XXXXXX", &output_path,
+                                 &error);
+        if (fd < 0) {
+            g_printerr("%s\n", error->message);
+            g_error_free(error);
+            return EXIT_FAILURE;
+        }
+        close(fd);
+    }
+
+    // Prepended, so they take precedence over the user's plugin options.
+    // The replay must never touch the real history, and `-calc-command`
+    // only ever reaches the no-op `helper_execute_command` above. A running
+    // daemon would answer from its cache and hold a different history.
+    const gchar *replay_args[] = {"-calc-trace", output_path,
+                                  "-no-persist-history", "-no-daemon",
+                                  "-calc-command-mode", "shell"};
+    for (gsize i = 0; i < G_N_ELEMENTS(replay_args); i++) {
+        g_ptr_array_insert(plugin_args, i, (gpointer)replay_args[i]);
+    }
+    gchar *self = g_file_read_link("/proc/self/exe", NULL);
+    if (stub) {
+        if (self == NULL) {
+            g_printerr("Can't find this binary to use as stub\n");
+            return EXIT_FAILURE;
+        }
+        g_ptr_array_insert(plugin_args, 0, self);
+        g_ptr_array_insert(plugin_args, 0, "-qalc-binary");
+        g_setenv(STUB_ENV, trace_path, TRUE);
+    }
+
+    GModule *module = g_module_open(module_path, G_MODULE_BIND_LAZY |
+                                                     G_MODULE_BIND_LOCAL);
+    if (module == NULL) {
+        g_printerr("Can't load %s: %s\n", module_path, g_module_error());
+        return EXIT_FAILURE;
+    }
+    if (!g_module_symbol(module, "mode", (gpointer *)&replay.mode)) {
+        g_printerr("%s is not a rofi plugin\n", module_path);
+        return EXIT_FAILURE;
+    }
+
+    replay.events = recorded;
+    replay.speed = speed;
+    replay.settle = MAX(settle, 0);
+    replay.loop = g_main_loop_new(NULL, FALSE);
+
+    replay.mode->_init(replay.mode);
+    replay.started = g_get_monotonic_time();
+    schedule_next_event();
+    g_main_loop_run(replay.loop);
+
+    GPtrArray *replayed = g_ptr_array_new_with_free_func(trace_event_free);
+    gboolean loaded = trace_load(output_path, replayed);
+
+    print_summary("recorded", recorded);
+    if (loaded) {
+        print_summary("replayed", replayed);
+    }
+    if (keep_output) {
+        printf("Trace of the replay written to %s\n", output_path);
+    } else {
+        g_unlink(output_path);
+    }
+
+    g_ptr_array_free(replayed, TRUE);
+    g_ptr_array_free(recorded, TRUE);
+    g_main_loop_unref(replay.loop);
+    g_module_close(module);
+    g_free(module_path);
+    g_free(output_path);
+    g_free(self);
+    return loaded ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,478 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "resident.h"
+
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/resource.h>
+
+// Every batch of inputs is followed by these two numbers. The two lines qalc
+// prints for them, in a row, mark the end of the batch's output, so a result
+// that happens to look like one of them doesn't end a batch early.
+#define SENTINEL_FIRST "7318294"
+#define SENTINEL_SECOND "4928137"
+
+// Milliseconds a freshly started qalc gets to answer the sentinels. One that
+// buffers its output when writing to a pipe never does.
+#define STARTUP_TIMEOUT 10000
+
+// Words of qalc commands that change its state, or read state left behind by
+// earlier inputs. Inputs containing them go to a fresh qalc so they can't
+// affect later evaluations.
+static const char *const STATEFUL_WORDS[] = {
+    "ans", "answer", "assume", "base", "clear", "copy", "delete", "exit",
+    "exrates", "function", "keep", "mode", "pop", "quit", "rotate", "rpn",
+    "save", "set", "stack", "store", "swap", "unit", "unkeep", "variable",
+    NULL,
+};
+
+// An evaluation waiting for, or running in, the resident qalc.
+typedef struct {
+    gchar **inputs;
+    guint timeout;
+    EvaluatorCallback callback;
+    gpointer user_data;
+} Job;
+
+struct ResidentEvaluator {
+    EvaluatorOptions options;
+    char *qalc_binary;
+    struct rlimit memory_limit;
+    GSubprocess *process;
+    GDataInputStream *output;
+    // Cancels reading from a process that was stopped.
+    GCancellable *cancellable;
+    // Whether the current process answered the sentinels yet.
+    gboolean started;
+    // Set once qalc couldn't be started or never answered, evaluations then
+    // start a qalc of their own.
+    gboolean unsupported;
+    // The lines qalc prints for the sentinels.
+    char *sentinel_first;
+    char *sentinel_second;
+    // Evaluations waiting for qalc, oldest first.
+    GQueue *jobs;
+    // The evaluation qalc is working on and the lines it printed so far.
+    Job *current;
+    GPtrArray *lines;
+    guint timeout_source;
+};
+
+static void run_next(ResidentEvaluator *resident);
+
+static void job_free(Job *job) {
+    g_strfreev(job->inputs);
+    g_free(job);
+}
+
+// Evaluate `job` with a qalc of its own.
+static void job_fallback(ResidentEvaluator *resident, Job *job) {
+    EvaluatorOptions options = resident->options;
+    options.timeout = job->timeout;
+
+    evaluator_run(&options, (const char *const *)job->inputs, job->callback,
+                  job->user_data);
+    job_free(job);
+}
+
+// Whether `inputs` can be evaluated without changing qalc's state.
+static gboolean is_stateless(const char *const *inputs) {
+    for (const char *const *input = inputs; *input != NULL; input++) {
+        if (strchr(*input, '\n') != NULL || strstr(*input, ":=") != NULL) {
+            return FALSE;
+        }
+
+        const char *curr = *input;
+        while (*curr) {
+            if (!g_ascii_isalpha(*curr)) {
+                curr++;
+                continue;
+            }
+
+            const char *word = curr;
+            while (g_ascii_isalpha(*curr)) {
+                curr++;
+            }
+            size_t length = curr - word;
+            for (const char *const *stateful = STATEFUL_WORDS;
+                 *stateful != NULL; stateful++) {
+                if (strlen(*stateful) == length &&
+                    g_ascii_strncasecmp(word, *stateful, length) == 0) {
+                    return FALSE;
+                }
+            }
+        }
+    }
+    return TRUE;
+}
+
+// Whether `line` is what qalc prints for the number `sentinel`. Only digits
+// are compared, whatever qalc's output format, and qalc may repeat the input
+// before the result.
+static gboolean is_sentinel(const char *line, const char *sentinel) {
+    GString *digits = g_string_new("");
+    for (const char *curr = line; *curr; curr++) {
+        if (g_ascii_isdigit(*curr)) {
+            g_string_append_c(digits, *curr);
+        }
+    }
+
+    size_t length = strlen(sentinel);
+    gboolean matches =
+        (digits->len == length || digits->len == 2 * length) &&
+        strncmp(digits->str, sentinel, length) == 0 &&
+        strcmp(digits->str + digits->len - length, sentinel) == 0;
+
+    g_string_free(digits, TRUE);
+    return matches;
+}
+
+// Runs in the child between fork and exec, so only async-signal-safe calls
+// are allowed here.
+static void apply_memory_limit(gpointer user_data) {
+    struct rlimit *memory_limit = (struct rlimit *)user_data;
+
+    if (memory_limit->rlim_cur > 0) {
+        setrlimit(RLIMIT_AS, memory_limit);
+    }
+}
+
+static void stop_process(ResidentEvaluator *resident) {
+    if (resident->timeout_source != 0) {
+        g_source_remove(resident->timeout_source);
+        resident->timeout_source = 0;
+    }
+    g_ptr_array_set_size(resident->lines, 0);
+
+    if (resident->process == NULL) {
+        return;
+    }
+
+    // A read may still be pending, it completes as cancelled.
+    g_cancellable_cancel(resident->cancellable);
+    g_subprocess_force_exit(resident->process);
+    g_clear_object(&resident->cancellable);
+    g_clear_object(&resident->output);
+    g_clear_object(&resident->process);
+    resident->started = FALSE;
+}
+
+// Stop using qalc and hand all evaluations to `evaluator_run`.
+static void give_up(ResidentEvaluator *resident) {
+    g_warning("%s can't be kept running, starting it for every evaluation "
+              "instead",
+              resident->qalc_binary);
+    resident->unsupported = TRUE;
+    stop_process(resident);
+
+    Job *job;
+    while ((job = g_queue_pop_head(resident->jobs)) != NULL) {
+        job_fallback(resident, job);
+    }
+}
+
+static void finish_current(ResidentEvaluator *resident,
+                           EvaluatorStatus status, char *result) {
+    Job *job = resident->current;
+
+    resident->current = NULL;
+    if (resident->timeout_source != 0) {
+        g_source_remove(resident->timeout_source);
+        resident->timeout_source = 0;
+    }
+    g_ptr_array_set_size(resident->lines, 0);
+
+    job->callback(status, result, job->user_data);
+    job_free(job);
+}
+
+// Write `inputs` followed by the sentinels to qalc.
+static gboolean write_inputs(ResidentEvaluator *resident,
+                             const char *const *inputs) {
+    GString *lines = g_string_new("");
+    for (const char *const *input = inputs; *input != NULL; input++) {
+        g_string_append(lines, *input);
+        g_string_append_c(lines, '\n');
+    }
+    g_string_append(lines, SENTINEL_FIRST "\n" SENTINEL_SECOND "\n");
+
+    gboolean written = g_output_stream_write_all(
+        g_subprocess_get_stdin_pipe(resident->process), lines->str,
+        lines->len, NULL, NULL, NULL);
+
+    g_string_free(lines, TRUE);
+    return written;
+}
+
+static void read_line_cb(GObject *source_object, GAsyncResult *res,
+                         gpointer user_data);
+
+static void read_next_line(ResidentEvaluator *resident) {
+    g_data_input_stream_read_line_async(resident->output, G_PRIORITY_DEFAULT,
+                                        resident->cancellable, read_line_cb,
+                                        resident);
+}
+
+static gboolean startup_timeout_cb(gpointer user_data) {
+    ResidentEvaluator *resident = (ResidentEvaluator *)user_data;
+
+    resident->timeout_source = 0;
+    give_up(resident);
+
+    return G_SOURCE_REMOVE;
+}
+
+static gboolean job_timeout_cb(gpointer user_data) {
+    ResidentEvaluator *resident = (ResidentEvaluator *)user_data;
+    guint timeout = resident->current->timeout;
+
+    resident->timeout_source = 0;
+    stop_process(resident);
+    finish_current(resident, EVALUATOR_TIMED_OUT,
+                   g_strdup_printf(EVALUATOR_TIMED_OUT_MESSAGE, timeout));
+    run_next(resident);
+
+    return G_SOURCE_REMOVE;
+}
+
+// Handle a line of qalc's output during startup, until it answered the
+// sentinels. Anything before them, such as warnings, is dropped.
+static void handle_startup_line(ResidentEvaluator *resident, char *line) {
+    const char *previous = resident->lines->len > 0
+                               ? g_ptr_array_index(resident->lines, 0)
+                               : NULL;
+
+    if (previous != NULL && is_sentinel(previous, SENTINEL_FIRST) &&
+        is_sentinel(line, SENTINEL_SECOND)) {
+        g_free(resident->sentinel_first);
+        g_free(resident->sentinel_second);
+        resident->sentinel_first = g_strdup(previous);
+        resident->sentinel_second = line;
+        resident->started = TRUE;
+
+        g_source_remove(resident->timeout_source);
+        resident->timeout_source = 0;
+        g_ptr_array_set_size(resident->lines, 0);
+
+        read_next_line(resident);
+        run_next(resident);
+        return;
+    }
+
+    g_ptr_array_set_size(resident->lines, 0);
+    g_ptr_array_add(resident->lines, line);
+    read_next_line(resident);
+}
+
+static void read_line_cb(GObject *source_object, GAsyncResult *res,
+                         gpointer user_data) {
+    GError *error = NULL;
+
+    char *line = g_data_input_stream_read_line_finish(
+        G_DATA_INPUT_STREAM(source_object), res, NULL, &error);
+
+    // The process was stopped, and `resident` may be gone already.
+    if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+        g_error_free(error);
+        return;
+    }
+
+    ResidentEvaluator *resident = (ResidentEvaluator *)user_data;
+
+    if (line == NULL) {
+        if (error != NULL) {
+            g_error_free(error);
+        }
+
+        if (!resident->started) {
+            give_up(resident);
+            return;
+        }
+
+        // Usually killed for exceeding its memory limit. The next
+        // evaluation starts a new qalc.
+        stop_process(resident);
+        if (resident->current != NULL) {
+            finish_current(resident, EVALUATOR_ABORTED,
+                           g_strdup(EVALUATOR_ABORTED_MESSAGE));
+        }
+        run_next(resident);
+        return;
+    }
+
+    if (!resident->started) {
+        handle_startup_line(resident, line);
+        return;
+    }
+
+    GPtrArray *lines = resident->lines;
+    const char *previous =
+        lines->len > 0 ? g_ptr_array_index(lines, lines->len - 1) : NULL;
+
+    if (resident->current == NULL) {
+        // Nothing was asked, there's nobody to tell.
+        g_free(line);
+    } else if (previous != NULL &&
+               strcmp(previous, resident->sentinel_first) == 0 &&
+               strcmp(line, resident->sentinel_second) == 0) {
+        g_ptr_array_set_size(lines, lines->len - 1);
+        g_ptr_array_add(lines, NULL);
+        char *result = g_strjoinv("\n", (gchar **)lines->pdata);
+        g_free(line);
+
+        read_next_line(resident);
+        finish_current(resident, EVALUATOR_DONE, result);
+        run_next(resident);
+        return;
+    } else {
+        g_ptr_array_add(lines, line);
+    }
+
+    read_next_line(resident);
+}
+
+static void start_process(ResidentEvaluator *resident) {
+    GError *error = NULL;
+
+    GPtrArray *argv = evaluator_argv(&resident->options);
+    g_ptr_array_add(argv, NULL);
+
+    GSubprocessLauncher *launcher = g_subprocess_launcher_new(
+        G_SUBPROCESS_FLAGS_STDIN_PIPE | G_SUBPROCESS_FLAGS_STDOUT_PIPE |
+        G_SUBPROCESS_FLAGS_STDERR_MERGE);
+    g_subprocess_launcher_set_child_setup(launcher, apply_memory_limit,
+                                          &resident->memory_limit, NULL);
+    resident->process = g_subprocess_launcher_spawnv(
+        launcher, (const gchar **)(argv->pdata), &error);
+    g_object_unref(launcher);
+    g_ptr_array_free(argv, TRUE);
+
+    // `evaluator_run` reports why qalc can't be started.
+    if (resident->process == NULL) {
+        g_error_free(error);
+        give_up(resident);
+        return;
+    }
+
+    resident->cancellable = g_cancellable_new();
+    resident->output = g_data_input_stream_new(
+        g_subprocess_get_stdout_pipe(resident->process));
+
+    const char *const no_inputs[] = {NULL};
+    if (!write_inputs(resident, no_inputs)) {
+        give_up(resident);
+        return;
+    }
+
+    resident->timeout_source =
+        g_timeout_add(STARTUP_TIMEOUT, startup_timeout_cb, resident);
+    read_next_line(resident);
+}
+
+// Hand the oldest waiting evaluation to qalc if it's idle, starting qalc
+// first if needed.
+static void run_next(ResidentEvaluator *resident) {
+    if (resident->current != NULL || g_queue_is_empty(resident->jobs)) {
+        return;
+    }
+
+    if (resident->process == NULL) {
+        start_process(resident);
+        return;
+    }
+    if (!resident->started) {
+        return;
+    }
+
+    resident->current = g_queue_pop_head(resident->jobs);
+    if (!write_inputs(resident,
+                      (const char *const *)resident->current->inputs)) {
+        stop_process(resident);
+        finish_current(resident, EVALUATOR_ABORTED,
+                       g_strdup(EVALUATOR_ABORTED_MESSAGE));
+        run_next(resident);
+        return;
+    }
+
+    if (resident->current->timeout > 0) {
+        resident->timeout_source = g_timeout_add(resident->current->timeout,
+                                                 job_timeout_cb, resident);
+    }
+}
+
+ResidentEvaluator *resident_evaluator_new(const EvaluatorOptions *options) {
+    ResidentEvaluator *resident = g_new0(ResidentEvaluator, 1);
+
+    resident->qalc_binary = g_strdup(options->qalc_binary);
+    resident->options = *options;
+    resident->options.qalc_binary = resident->qalc_binary;
+    resident->memory_limit.rlim_cur = (rlim_t)options->memory_limit << 20;
+    resident->memory_limit.rlim_max = resident->memory_limit.rlim_cur;
+    resident->jobs = g_queue_new();
+    resident->lines = g_ptr_array_new_with_free_func(g_free);
+
+    return resident;
+}
+
+void resident_evaluator_run(ResidentEvaluator *resident,
+                            const EvaluatorOptions *options,
+                            const char *const *inputs,
+                            EvaluatorCallback callback, gpointer user_data) {
+    Job *job = g_new0(Job, 1);
+    job->inputs = g_strdupv((gchar **)inputs);
+    job->timeout = evaluator_timeout(options);
+    job->callback = callback;
+    job->user_data = user_data;
+
+    if (resident->unsupported || !is_stateless(inputs)) {
+        job_fallback(resident, job);
+        return;
+    }
+
+    g_queue_push_tail(resident->jobs, job);
+    run_next(resident);
+}
+
+void resident_evaluator_free(gpointer data) {
+    ResidentEvaluator *resident = (ResidentEvaluator *)data;
+
+    stop_process(resident);
+
+    if (resident->current != NULL) {
+        job_fallback(resident, resident->current);
+    }
+    Job *job;
+    while ((job = g_queue_pop_head(resident->jobs)) != NULL) {
+        job_fallback(resident, job);
+    }
+
+    g_queue_free(resident->jobs);
+    g_ptr_array_unref(resident->lines);
+    g_free(resident->sentinel_first);
+    g_free(resident->sentinel_second);
+    g_free(resident->qalc_binary);
+    g_free(resident);
+}
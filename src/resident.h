@@ -0,0 +1,57 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#ifndef ROFI_CALC_RESIDENT_H
+#define ROFI_CALC_RESIDENT_H
+
+#include <glib.h>
+
+#include "evaluator.h"
+
+// A qalc process that is kept running between evaluations, so loading its
+// definitions and exchange rates is paid for once instead of on every
+// keystroke. Inputs are written to its stdin and its answers read back.
+//
+// If qalc never answers through a pipe, or an input could change qalc's
+// state for later evaluations, evaluations fall back to `evaluator_run`.
+typedef struct ResidentEvaluator ResidentEvaluator;
+
+// Create a resident evaluator for `options`. qalc is started with the first
+// evaluation. CPU limits add up over a process' lifetime, so `options` must
+// not have one.
+ResidentEvaluator *resident_evaluator_new(const EvaluatorOptions *options);
+
+// Like `evaluator_run`, for evaluator options equal to those `resident` was
+// created with except for the timeout. Evaluations run one after another.
+void resident_evaluator_run(ResidentEvaluator *resident,
+                            const EvaluatorOptions *options,
+                            const char *const *inputs,
+                            EvaluatorCallback callback, gpointer user_data);
+
+// Stop qalc. Evaluations that haven't finished yet are handed to
+// `evaluator_run`.
+void resident_evaluator_free(gpointer resident);
+
+#endif
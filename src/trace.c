@@ -0,0 +1,123 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "protocol.h"
+
+struct Trace {
+    FILE *file;
+    gint64 started;
+};
+
+Trace *trace_open(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        g_warning("Can't write trace to %s: %s", path, g_strerror(errno));
+        return NULL;
+    }
+
+    Trace *trace = g_new0(Trace, 1);
+    trace->file = file;
+    trace->started = g_get_monotonic_time();
+    fputs(TRACE_HEADER "\n", file);
+    return trace;
+}
+
+void trace_write(Trace *trace, const gchar *const *fields) {
+    gchar *time = g_strdup_printf(
+        "%" G_GINT64_FORMAT, g_get_monotonic_time() - trace->started);
+    guint length = g_strv_length((gchar **)fields);
+    const gchar **line_fields = g_new0(const gchar *, length + 2);
+
+    line_fields[0] = time;
+    memcpy(line_fields + 1, fields, length * sizeof(*fields));
+
+    // Flushed right away, sessions that end in a crash matter the most.
+    gchar *line = protocol_join(line_fields);
+    fputs(line, trace->file);
+    fflush(trace->file);
+
+    g_free(line);
+    g_free(line_fields);
+    g_free(time);
+}
+
+void trace_close(Trace *trace) {
+    fclose(trace->file);
+    g_free(trace);
+}
+
+gboolean trace_load(const char *path, GPtrArray *events) {
+    GError *error = NULL;
+    gchar *contents = NULL;
+
+    if (!g_file_get_contents(path, &contents, NULL, &error)) {
+        g_warning("Can't read trace %s: %s", path, error->message);
+        g_error_free(error);
+        return FALSE;
+    }
+
+    gchar **lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    if (strcmp(lines[0], TRACE_HEADER) != 0) {
+        g_warning("%s is not a rofi-calc trace", path);
+        g_strfreev(lines);
+        return FALSE;
+    }
+
+    for (gchar **line = lines + 1; *line != NULL; line++) {
+        if (**line == '\0') {
+            continue;
+        }
+
+        gchar **fields = protocol_split(*line);
+        if (g_strv_length(fields) < 2) {
+            // Most likely the last line of a trace that was cut short.
+            g_strfreev(fields);
+            continue;
+        }
+
+        TraceEvent *event = g_new0(TraceEvent, 1);
+        event->time = g_ascii_strtoll(fields[0], NULL, 10);
+        // Drop the time, keep the event name and its fields.
+        event->fields = g_strdupv(fields + 1);
+        g_ptr_array_add(events, event);
+        g_strfreev(fields);
+    }
+
+    g_strfreev(lines);
+    return TRUE;
+}
+
+void trace_event_free(gpointer data) {
+    TraceEvent *event = (TraceEvent *)data;
+    g_strfreev(event->fields);
+    g_free(event);
+}
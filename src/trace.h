@@ -0,0 +1,73 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#ifndef ROFI_CALC_TRACE_H
+#define ROFI_CALC_TRACE_H
+
+#include <glib.h>
+
+// Session traces, written by the plugin with `-calc-trace` and read back by
+// `rofi-calc-replay`.
+//
+// A trace starts with `TRACE_HEADER`, followed by one event per line in the
+// format of `protocol_join`:
+//
+//     <time> INPUT <input>
+//     <time> RESULT <menu entry> <selected line> <input>
+//     <time> EVALUATION <kind> <status> <latency> <result> <input>...
+//
+// Times count from when the trace was opened. Times and latencies are in
+// microseconds.
+
+#define TRACE_HEADER "# rofi-calc trace v1"
+
+#define TRACE_INPUT "INPUT"
+#define TRACE_RESULT "RESULT"
+#define TRACE_EVALUATION "EVALUATION"
+
+typedef struct Trace Trace;
+
+// One event of a loaded trace.
+typedef struct {
+    gint64 time;
+    // The event name, followed by its fields.
+    gchar **fields;
+} TraceEvent;
+
+// Start a new trace at `path`, replacing any existing file. Returns NULL if
+// the file can't be written.
+Trace *trace_open(const char *path);
+
+// Append an event. `fields` starts with the event name.
+void trace_write(Trace *trace, const gchar *const *fields);
+
+void trace_close(Trace *trace);
+
+// Load the events of the trace at `path` into `events` as `TraceEvent`s.
+// Returns FALSE if the file can't be read or isn't a trace.
+gboolean trace_load(const char *path, GPtrArray *events);
+
+void trace_event_free(gpointer event);
+
+#endif
@@ -0,0 +1,243 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+// Tests for `rofi-calcd`, started on a socket in a temporary directory. Its
+// path is passed as the first argument. Evaluations run stand-ins for qalc
+// from `STUB_DIR`.
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <signal.h>
+#include <string.h>
+
+#include "history.h"
+#include "protocol.h"
+
+// Give up on a daemon that doesn't come up, in milliseconds.
+#define TEST_DEADLINE 5000
+
+#define STUB_QALC STUB_DIR "/stub-qalc-count"
+
+static gchar *socket_path;
+
+// Send the request `fields` to the daemon and return its reply fields.
+static gchar **request(const gchar *const *fields) {
+    GError *error = NULL;
+    GSocketClient *client = g_socket_client_new();
+    GSocketAddress *address = g_unix_socket_address_new(socket_path);
+    GSocketConnection *connection = g_socket_client_connect(
+        client, G_SOCKET_CONNECTABLE(address), NULL, &error);
+    g_assert_no_error(error);
+    g_object_unref(address);
+    g_object_unref(client);
+
+    gchar *line = protocol_join(fields);
+    g_output_stream_write_all(
+        g_io_stream_get_output_stream(G_IO_STREAM(connection)), line,
+        strlen(line), NULL, NULL, &error);
+    g_assert_no_error(error);
+    g_free(line);
+
+    GDataInputStream *input = g_data_input_stream_new(
+        g_io_stream_get_input_stream(G_IO_STREAM(connection)));
+    line = g_data_input_stream_read_line(input, NULL, NULL, &error);
+    g_assert_no_error(error);
+    g_assert_nonnull(line);
+    gchar **reply = protocol_split(line);
+
+    g_free(line);
+    g_object_unref(input);
+    g_object_unref(connection);
+    return reply;
+}
+
+// Evaluate `input` with `qalc_binary` and return the reply fields.
+static gchar **evaluate(const char *qalc_binary, const char *input) {
+    EvaluatorOptions options = {
+        .qalc_binary = qalc_binary,
+        .timeout = EVALUATOR_DEFAULT_TIMEOUT,
+    };
+    gchar *flags = protocol_format_flags(&options);
+    gchar *limits = protocol_format_limits(&options);
+    const gchar *fields[] = {PROTOCOL_EVAL, flags, limits, qalc_binary,
+                             input, NULL};
+
+    gchar **reply = request(fields);
+
+    g_free(limits);
+    g_free(flags);
+    return reply;
+}
+
+static void assert_result(gchar **reply, const char *result) {
+    gchar *done = protocol_format_status(EVALUATOR_DONE);
+
+    g_assert_cmpuint(g_strv_length(reply), ==, 3);
+    g_assert_cmpstr(reply[0], ==, PROTOCOL_OK);
+    g_assert_cmpstr(reply[1], ==, done);
+    g_assert_cmpstr(reply[2], ==, result);
+
+    g_free(done);
+    g_strfreev(reply);
+}
+
+static void test_eval(void) {
+    // One qalc answers both, so the count goes up.
+    assert_result(evaluate(STUB_QALC, "1 + 1"), "1 + 1 = 1");
+    assert_result(evaluate(STUB_QALC, "2 + 2"), "2 + 2 = 2");
+    // Served from the cache, qalc would have answered `1 + 1 = 3`.
+    assert_result(evaluate(STUB_QALC, "1 + 1"), "1 + 1 = 1");
+}
+
+static void test_eval_error(void) {
+    gchar **reply = evaluate(STUB_DIR "/stub-qalc-broken", "1 + 1");
+    g_assert_cmpstr(reply[0], ==, PROTOCOL_ERR);
+    g_strfreev(reply);
+
+    // The plugin evaluates on its own after an error, the daemon keeps
+    // serving other requests.
+    reply = evaluate(STUB_QALC, "3 + 3");
+    g_assert_cmpstr(reply[0], ==, PROTOCOL_OK);
+    g_assert_true(g_str_has_prefix(reply[2], "3 + 3 = "));
+    g_strfreev(reply);
+}
+
+// Fetch the daemon's history as records.
+static GPtrArray *fetch_history(void) {
+    const gchar *fields[] = {PROTOCOL_HISTORY, NULL};
+    gchar **reply = request(fields);
+    GPtrArray *history = g_ptr_array_new_with_free_func(history_record_free);
+
+    g_assert_cmpstr(reply[0], ==, PROTOCOL_OK);
+    for (gchar **entry = reply + 1; *entry != NULL; entry++) {
+        HistoryRecord *record = history_record_deserialize(*entry);
+        g_assert_nonnull(record);
+        g_ptr_array_add(history, record);
+    }
+
+    g_strfreev(reply);
+    return history;
+}
+
+static void history_request(const char *kind, const HistoryRecord *record,
+                            const char *expected) {
+    gchar *line = history_record_serialize(record);
+    const gchar *fields[] = {kind, line, NULL};
+    gchar **reply = request(fields);
+
+    g_assert_cmpstr(reply[0], ==, expected);
+
+    g_strfreev(reply);
+    g_free(line);
+}
+
+static void test_history(void) {
+    HistoryRecord *first = history_record_new("1 + 1 = 2", FALSE, "u");
+    HistoryRecord *second = history_record_new("pi ≈ 3.14", FALSE, "u");
+    second->timestamp++;
+
+    GPtrArray *history = fetch_history();
+    g_assert_cmpuint(history->len, ==, 0);
+    g_ptr_array_unref(history);
+
+    history_request(PROTOCOL_HISTORY_ADD, first, PROTOCOL_OK);
+    history_request(PROTOCOL_HISTORY_ADD, second, PROTOCOL_OK);
+
+    history = fetch_history();
+    g_assert_cmpuint(history->len, ==, 2);
+    g_assert_true(history_record_equal(history->pdata[0], first));
+    g_assert_true(history_record_equal(history->pdata[1], second));
+    g_ptr_array_unref(history);
+
+    // Deleted by content, both from memory and from the file.
+    history_request(PROTOCOL_HISTORY_DELETE, first, PROTOCOL_OK);
+
+    history = fetch_history();
+    g_assert_cmpuint(history->len, ==, 1);
+    g_assert_true(history_record_equal(history->pdata[0], second));
+    g_ptr_array_unref(history);
+
+    history = g_ptr_array_new_with_free_func(history_record_free);
+    load_history(history);
+    g_assert_cmpuint(history->len, ==, 1);
+    g_assert_true(history_record_equal(history->pdata[0], second));
+    g_ptr_array_unref(history);
+
+    const gchar *malformed[] = {PROTOCOL_HISTORY_DELETE, "3", NULL};
+    gchar **reply = request(malformed);
+    g_assert_cmpstr(reply[0], ==, PROTOCOL_ERR);
+    g_strfreev(reply);
+
+    history_record_free(first);
+    history_record_free(second);
+}
+
+int main(int argc, char **argv) {
+    GError *error = NULL;
+
+    // The daemon inherits this, so both keep their history in here.
+    gchar *data_dir = g_dir_make_tmp("rofi-calcd-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    g_setenv("XDG_DATA_HOME", data_dir, TRUE);
+
+    g_test_init(&argc, &argv, NULL);
+    g_assert_cmpint(argc, ==, 2);
+
+    socket_path = g_build_filename(data_dir, "s", NULL);
+    GSubprocess *daemon = g_subprocess_new(G_SUBPROCESS_FLAGS_NONE, &error,
+                                           argv[1], "--socket", socket_path,
+                                           NULL);
+    g_assert_no_error(error);
+
+    gint64 deadline = g_get_monotonic_time() + TEST_DEADLINE * 1000;
+    while (!g_file_test(socket_path, G_FILE_TEST_EXISTS)) {
+        g_assert_cmpint(g_get_monotonic_time(), <, deadline);
+        g_usleep(10000);
+    }
+
+    g_test_add_func("/daemon/eval", test_eval);
+    g_test_add_func("/daemon/eval-error", test_eval_error);
+    g_test_add_func("/daemon/history", test_history);
+    int status = g_test_run();
+
+    g_subprocess_send_signal(daemon, SIGTERM);
+    g_subprocess_wait(daemon, NULL, NULL);
+    g_object_unref(daemon);
+
+    gchar *history_dir = g_build_filename(data_dir, "rofi", NULL);
+    gchar *history_file =
+        g_build_filename(history_dir, "rofi_calc_history", NULL);
+    g_remove(history_file);
+    g_rmdir(history_dir);
+    g_rmdir(data_dir);
+    g_free(history_file);
+    g_free(history_dir);
+    g_free(socket_path);
+    g_free(data_dir);
+
+    return status;
+}
@@ -0,0 +1,156 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+// Tests for the evaluation deadline and for qalc dying or misbehaving. They
+// run stand-ins for qalc from `STUB_DIR` instead of the real thing.
+
+#include <glib.h>
+#include <string.h>
+
+#include "evaluator.h"
+
+// Give up on a test that would otherwise hang, in milliseconds.
+#define TEST_DEADLINE 5000
+
+typedef struct {
+    GMainLoop *loop;
+    gboolean finished;
+    EvaluatorStatus status;
+    char *result;
+} Outcome;
+
+static void evaluation_cb(EvaluatorStatus status, char *result,
+                          gpointer user_data) {
+    Outcome *outcome = (Outcome *)user_data;
+
+    outcome->finished = TRUE;
+    outcome->status = status;
+    outcome->result = result;
+    g_main_loop_quit(outcome->loop);
+}
+
+static gboolean deadline_cb(gpointer user_data) {
+    g_main_loop_quit(((Outcome *)user_data)->loop);
+    return G_SOURCE_REMOVE;
+}
+
+// Evaluate `1 + 1` with `options` and wait for the outcome.
+static void run_evaluation(EvaluatorOptions *options, Outcome *outcome) {
+    const char *inputs[] = {"1 + 1", NULL};
+
+    outcome->loop = g_main_loop_new(NULL, FALSE);
+    evaluator_run(options, inputs, evaluation_cb, outcome);
+    guint deadline = g_timeout_add(TEST_DEADLINE, deadline_cb, outcome);
+    g_main_loop_run(outcome->loop);
+
+    g_assert_true(outcome->finished);
+    g_source_remove(deadline);
+    g_main_loop_unref(outcome->loop);
+}
+
+static void test_timeout(void) {
+    EvaluatorOptions options = {
+        .qalc_binary = STUB_DIR "/stub-qalc-hang",
+        .timeout = 200,
+    };
+    Outcome outcome = {0};
+    gint64 started = g_get_monotonic_time();
+
+    run_evaluation(&options, &outcome);
+
+    g_assert_cmpint(outcome.status, ==, EVALUATOR_TIMED_OUT);
+    g_assert_nonnull(strstr(outcome.result, "timed out after 200 ms"));
+    g_assert_cmpint(g_get_monotonic_time() - started, <,
+                    TEST_DEADLINE * 1000 / 2);
+    g_free(outcome.result);
+}
+
+static void test_quick_timeout(void) {
+    // Quick evaluations are capped even without a deadline of their own.
+    EvaluatorOptions options = {
+        .qalc_binary = STUB_DIR "/stub-qalc-hang",
+        .quick = TRUE,
+    };
+    Outcome outcome = {0};
+
+    run_evaluation(&options, &outcome);
+
+    g_assert_cmpint(outcome.status, ==, EVALUATOR_TIMED_OUT);
+    g_free(outcome.result);
+}
+
+static void test_killed(void) {
+    EvaluatorOptions options = {
+        .qalc_binary = STUB_DIR "/stub-qalc-killed",
+        .timeout = EVALUATOR_DEFAULT_TIMEOUT,
+    };
+    Outcome outcome = {0};
+
+    run_evaluation(&options, &outcome);
+
+    g_assert_cmpint(outcome.status, ==, EVALUATOR_ABORTED);
+    g_assert_true(g_str_has_prefix(outcome.result, "error:"));
+    g_free(outcome.result);
+}
+
+static void test_broken(void) {
+    EvaluatorOptions options = {
+        .qalc_binary = STUB_DIR "/stub-qalc-broken",
+        .timeout = EVALUATOR_DEFAULT_TIMEOUT,
+    };
+    Outcome outcome = {0};
+
+    run_evaluation(&options, &outcome);
+
+    g_assert_cmpint(outcome.status, ==, EVALUATOR_FAILED);
+    g_assert_true(g_str_has_prefix(outcome.result, "error:"));
+    g_free(outcome.result);
+}
+
+static void test_missing(void) {
+    EvaluatorOptions options = {
+        .qalc_binary = STUB_DIR "/does-not-exist",
+        .timeout = EVALUATOR_DEFAULT_TIMEOUT,
+    };
+    Outcome outcome = {0};
+
+    run_evaluation(&options, &outcome);
+
+    g_assert_cmpint(outcome.status, ==, EVALUATOR_FAILED);
+    g_assert_true(g_str_has_prefix(outcome.result, "error:"));
+    g_free(outcome.result);
+}
+
+int main(int argc, char **argv) {
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/evaluator/timeout", test_timeout);
+    g_test_add_func("/evaluator/quick-timeout", test_quick_timeout);
+    g_test_add_func("/evaluator/killed", test_killed);
+    g_test_add_func("/evaluator/broken", test_broken);
+    g_test_add_func("/evaluator/missing", test_missing);
+
+    return g_test_run();
+}
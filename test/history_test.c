@@ -0,0 +1,234 @@
+// rofi-calc
+//
+// MIT/X11 License
+// Copyright (c) 2018 Sven-Hendrik Haase <svenstaro@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining
+// a copy of this software and associated documentation files (the
+// "Software"), to deal in the Software without restriction, including
+// without limitation the rights to use, copy, modify, merge, publish,
+// distribute, sublicense, and/or sell copies of the Software, and to
+// permit persons to whom the Software is furnished to do so, subject to
+// the following conditions:
+//
+// The above copyright notice and this permission notice shall be
+// included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY
+// CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+// TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+// Tests for parsing qalc's output into history records, for serializing
+// records and for migrating old history files.
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#include "history.h"
+
+// First line of a history file holding serialized records.
+#define HISTORY_HEADER "# rofi-calc history v2\n"
+
+static gchar *history_file;
+
+typedef struct {
+    const char *output;
+    gboolean terse;
+    const char *expression;
+    const char *result;
+    gboolean approximate;
+} ParseCase;
+
+static const ParseCase parse_cases[] = {
+    {"1 + 1 = 2", FALSE, "1 + 1", "2", FALSE},
+    {"pi ≈ 3.141592654", FALSE, "pi", "3.141592654", TRUE},
+    // The last sign outside of parentheses separates the result.
+    {"20x + 40 = 100", FALSE, "20x + 40", "100", FALSE},
+    {"20x + 40 = 100 = (x = 3)", FALSE, "20x + 40 = 100", "(x = 3)", FALSE},
+    {"solve(2x = 4) = 2", FALSE, "solve(2x = 4)", "2", FALSE},
+    {"f((a = b) ≈ c) ≈ 0.5", FALSE, "f((a = b) ≈ c)", "0.5", TRUE},
+    {"x = y ≈ 3", FALSE, "x = y", "3", TRUE},
+    {"x ≈ y = 3", FALSE, "x ≈ y", "3", FALSE},
+    // Without a separating sign everything is the result.
+    {"error: unknown variable", FALSE, NULL, "error: unknown variable",
+     FALSE},
+    {"= 3", FALSE, NULL, "= 3", FALSE},
+    // With -terse, output is the result.
+    {"2", TRUE, NULL, "2", FALSE},
+    {"x = 3", TRUE, NULL, "x = 3", FALSE},
+};
+
+static void test_parse(void) {
+    for (gsize i = 0; i < G_N_ELEMENTS(parse_cases); i++) {
+        const ParseCase *test = &parse_cases[i];
+        HistoryRecord *record =
+            history_record_new(test->output, test->terse, "u");
+
+        g_assert_cmpstr(record->expression, ==, test->expression);
+        g_assert_cmpstr(record->result, ==, test->result);
+        g_assert_cmpint(record->approximate, ==, test->approximate);
+        g_assert_cmpstr(record->flags, ==, "u");
+
+        // Formatting gives back what qalc printed.
+        gchar *formatted = history_record_format(record);
+        g_assert_cmpstr(formatted, ==, test->output);
+        g_free(formatted);
+
+        history_record_free(record);
+    }
+}
+
+static void test_to_string(void) {
+    HistoryRecord *record = history_record_new("a\nb = 1\n2", FALSE, "");
+
+    gchar *line = history_record_to_string(record);
+    g_assert_cmpstr(line, ==, "a;b = 1;2");
+
+    g_free(line);
+    history_record_free(record);
+}
+
+static void test_round_trip(void) {
+    HistoryRecord records[] = {
+        {"a\tb\\c\nd", "1\n2\\", TRUE, 1234, "tuq"},
+        {NULL, "\t\\t\\\\", FALSE, 0, ""},
+        {"\\", "\n", FALSE, -1, "u"},
+    };
+
+    for (gsize i = 0; i < G_N_ELEMENTS(records); i++) {
+        gchar *line = history_record_serialize(&records[i]);
+        g_assert_null(strchr(line, '\n'));
+
+        HistoryRecord *record = history_record_deserialize(line);
+        g_assert_nonnull(record);
+        g_assert_true(history_record_equal(record, &records[i]));
+
+        history_record_free(record);
+        g_free(line);
+    }
+}
+
+static void test_deserialize_malformed(void) {
+    const char *lines[] = {"", "1\tu\t=\t1 + 1", "1\tu\t=\t1\t2\t3"};
+
+    for (gsize i = 0; i < G_N_ELEMENTS(lines); i++) {
+        g_assert_null(history_record_deserialize(lines[i]));
+    }
+}
+
+static GPtrArray *load(void) {
+    GPtrArray *history = g_ptr_array_new_with_free_func(history_record_free);
+    load_history(history);
+    return history;
+}
+
+static void assert_migrated(void) {
+    gchar *contents = NULL;
+
+    g_assert_true(g_file_get_contents(history_file, &contents, NULL, NULL));
+    g_assert_true(g_str_has_prefix(contents, HISTORY_HEADER));
+    g_free(contents);
+}
+
+static void test_migrate(void) {
+    const char *legacy = "1 + 1 = 2\n\npi ≈ 3.14\n";
+    g_assert_true(g_file_set_contents(history_file, legacy, -1, NULL));
+
+    GPtrArray *history = load();
+    g_assert_cmpuint(history->len, ==, 2);
+
+    HistoryRecord *first = history->pdata[0];
+    g_assert_cmpstr(first->expression, ==, "1 + 1");
+    g_assert_cmpstr(first->result, ==, "2");
+    g_assert_cmpint(first->timestamp, ==, 0);
+    HistoryRecord *second = history->pdata[1];
+    g_assert_cmpstr(second->expression, ==, "pi");
+    g_assert_true(second->approximate);
+
+    assert_migrated();
+
+    // Loading the migrated file gives the same records.
+    GPtrArray *reloaded = load();
+    g_assert_cmpuint(reloaded->len, ==, history->len);
+    for (guint i = 0; i < history->len; i++) {
+        g_assert_true(history_record_equal(reloaded->pdata[i],
+                                           history->pdata[i]));
+    }
+
+    g_ptr_array_unref(reloaded);
+    g_ptr_array_unref(history);
+}
+
+static void test_migrate_empty(void) {
+    g_assert_true(g_file_set_contents(history_file, "", -1, NULL));
+
+    GPtrArray *history = load();
+    g_assert_cmpuint(history->len, ==, 0);
+    assert_migrated();
+
+    g_ptr_array_unref(history);
+}
+
+static void test_append_delete(void) {
+    g_assert_true(g_file_set_contents(history_file, HISTORY_HEADER, -1, NULL));
+
+    HistoryRecord *record = history_record_new("1 + 1 = 2", FALSE, "u");
+    HistoryRecord *other = history_record_copy(record);
+    other->timestamp++;
+
+    append_record_to_history(record);
+    append_record_to_history(other);
+    append_record_to_history(record);
+
+    // Only the most recent equal record goes.
+    delete_record_from_history(record);
+
+    GPtrArray *history = load();
+    g_assert_cmpuint(history->len, ==, 2);
+    g_assert_true(history_record_equal(history->pdata[0], record));
+    g_assert_true(history_record_equal(history->pdata[1], other));
+
+    g_ptr_array_unref(history);
+    history_record_free(other);
+    history_record_free(record);
+}
+
+int main(int argc, char **argv) {
+    GError *error = NULL;
+
+    // Keep the history file of these tests away from the real one.
+    gchar *data_dir = g_dir_make_tmp("rofi-calc-history-test-XXXXXX", &error);
+    g_assert_no_error(error);
+    g_setenv("XDG_DATA_HOME", data_dir, TRUE);
+
+    gchar *history_dir = g_build_filename(data_dir, "rofi", NULL);
+    g_mkdir_with_parents(history_dir, 0755);
+    history_file = g_build_filename(history_dir, "rofi_calc_history", NULL);
+
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/history/parse", test_parse);
+    g_test_add_func("/history/to-string", test_to_string);
+    g_test_add_func("/history/round-trip", test_round_trip);
+    g_test_add_func("/history/deserialize-malformed",
+                    test_deserialize_malformed);
+    g_test_add_func("/history/migrate", test_migrate);
+    g_test_add_func("/history/migrate-empty", test_migrate_empty);
+    g_test_add_func("/history/append-delete", test_append_delete);
+    int status = g_test_run();
+
+    g_remove(history_file);
+    g_rmdir(history_dir);
+    g_rmdir(data_dir);
+    g_free(history_file);
+    g_free(history_dir);
+    g_free(data_dir);
+
+    return status;
+}